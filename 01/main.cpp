@@ -1,12 +1,305 @@
 /* ヘッダファイルのインクルード */
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <charconv>
+
+/*
+ * 標準入力 (または引数で指定したファイル) から "a b" の行を読み，
+ * 1行ごとに "a / b = a/b" を出力する．
+ * b == 0 の行は "a / 0 = undefined" を出力し，数として読めない行は読み飛ばす．
+ * どちらも件数を最後に標準エラー出力へ報告する．
+ */
+
+// 一度にまとめて割り算する行数
+static const int batch_size = 4096;
+// 出力バッファの大きさ
+static const size_t out_size = 1 << 20;
+// 標準入力をパイプから読むときの読み込み単位
+static const size_t in_size = 1 << 20;
+
+static char out_buf[out_size];
+static size_t out_len = 0;
+// 書き出しに失敗したか (失敗したら以後の入力は処理しない)
+static bool out_failed = false;
+
+// 出力バッファを書き出す
+static void flush_output() {
+    size_t done = 0;
+    while (!out_failed && done < out_len) {
+        const ssize_t w = write(STDOUT_FILENO, out_buf + done, out_len - done);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            perror("write");
+            out_failed = true;
+            break;
+        }
+        done += w;
+    }
+    out_len = 0;
+}
+
+/*
+ * まとめて処理する行
+ * a, b: 読みとった整数
+ * q: a / b の結果
+ * count: 溜まっている行数
+ */
+static int batch_a[batch_size];
+static int batch_b[batch_size];
+static double batch_q[batch_size];
+static int batch_count = 0;
+
+// 件数の集計 (count_lines は空行を除いた行数)
+static long long count_lines = 0;
+static long long count_zero = 0;
+static long long count_bad = 0;
+// 読んだ行の数 (空行も含む．読み飛ばした行の番号の報告に使う)
+static long long line_no = 0;
+
+/*
+ * format_fixed6: q を printf("%f") と同じ表記 (小数点以下6桁，最近接偶数への丸め) で p に書き，
+ * 書き終えた位置を返す．|q| <= 2^31 (int どうしの商) のときだけ使える．
+ * 汎用の浮動小数点数の変換は遅いので，q = m * 2^e (m は53ビットの整数, e < 0) として
+ * q * 10^6 を128ビット整数で誤差なく求めて丸め，整数として書く
+ */
+static char *format_fixed6(char *p, double q) {
+    uint64_t bits;
+    memcpy(&bits, &q, sizeof(bits));
+    if (bits >> 63)
+        *p++ = '-';
+
+    // r: |q| * 10^6 を丸めた整数
+    uint64_t r = 0;
+    const int biased = (int)((bits >> 52) & 0x7ff);
+    if (biased != 0) {
+        const uint64_t m = (bits & ((1ULL << 52) - 1)) | (1ULL << 52);
+        const int s = 1075 - biased;  // q = m * 2^-s (|q| <= 2^31 なので s >= 21)
+        const unsigned __int128 n = (unsigned __int128)m * 1000000;
+        // n < 2^73 なので，s > 74 なら 0.5 未満で r = 0 のまま
+        if (s <= 74) {
+            r = (uint64_t)(n >> s);
+            const unsigned __int128 rem = n - ((unsigned __int128)r << s);
+            const unsigned __int128 half = (unsigned __int128)1 << (s - 1);
+            if (rem > half || (rem == half && (r & 1)))
+                r++;
+        }
+    }
+
+    p = std::to_chars(p, p + 11, r / 1000000).ptr;
+    *p++ = '.';
+    uint32_t f = (uint32_t)(r % 1000000);
+    for (int i = 5; i >= 0; i--) {
+        p[i] = (char)('0' + f % 10);
+        f /= 10;
+    }
+    return p + 6;
+}
+
+// 溜まった行をまとめて割り算し，出力する
+static void flush_batch() {
+    const int n = batch_count;
+
+    // 0割りの行は分母を1に置き換えておき，分岐のないループにしてベクトル化させる
+    for (int i = 0; i < n; i++) {
+        const double den = batch_b[i] != 0 ? (double)batch_b[i] : 1.0;
+        batch_q[i] = (double)batch_a[i] / den;
+    }
+
+    for (int i = 0; i < n; i++) {
+        // 1行分を組み立ててから出力バッファに移す
+        // (int は符号込みで11文字，|a/b| <= 2^31 の小数点以下6桁表記は18文字に収まる)
+        char line[64];
+        char *p = line;
+        p = std::to_chars(p, p + 11, batch_a[i]).ptr;
+        *p++ = ' ';
+        *p++ = '/';
+        *p++ = ' ';
+        p = std::to_chars(p, p + 11, batch_b[i]).ptr;
+        *p++ = ' ';
+        *p++ = '=';
+        *p++ = ' ';
+        if (batch_b[i] != 0) {
+            p = format_fixed6(p, batch_q[i]);
+        } else {
+            memcpy(p, "undefined", 9);
+            p += 9;
+            count_zero++;
+        }
+        *p++ = '\n';
+        if (out_size - out_len < (size_t)(p - line))
+            flush_output();
+        memcpy(out_buf + out_len, line, p - line);
+        out_len += p - line;
+    }
+    batch_count = 0;
+}
+
+// report_bad: 今の行 (line_no 行目) を読み飛ばしたことを記録する．最初の10行だけ報告する
+static void report_bad() {
+    if (count_bad < 10)
+        fprintf(stderr, "line %lld: cannot read two integers, skipped\n", line_no);
+    count_bad++;
+}
+
+// parse_int: [*pp, end) の先頭から符号付き整数を読む．int に収まらなければ false
+static bool parse_int(const char **pp, const char *end, int *value) {
+    const char *p = *pp;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+    int64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p - '0');
+        if (v > (int64_t)INT_MAX + 1)
+            return false;
+        p++;
+    }
+    if (neg)
+        v = -v;
+    if (v > INT_MAX || v < INT_MIN)
+        return false;
+    *value = (int)v;
+    *pp = p;
+    return true;
+}
+
+// parse_lines: [begin, end) の完全な行をすべて処理し，処理し終えた位置を返す
+// final が false なら，改行で終わっていない最後の行は処理せずに残す．
+// 書き出しに失敗したらそこで止め，end を返す
+static const char *parse_lines(const char *begin, const char *end, bool final) {
+    const char *p = begin;
+    while (p < end) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            if (!final)
+                break;
+            eol = end;
+        }
+        line_no++;
+
+        // "a b" の形になっているか (前後と間の空白は何個でもよい)
+        const char *q = p;
+        int a, b;
+        while (q < eol && (*q == ' ' || *q == '\t'))
+            q++;
+        if (q < eol && *q != '\r') {
+            count_lines++;
+            bool ok = parse_int(&q, eol, &a);
+            const char *sep = q;
+            while (q < eol && (*q == ' ' || *q == '\t'))
+                q++;
+            ok = ok && q > sep && parse_int(&q, eol, &b);
+            while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r'))
+                q++;
+            if (ok && q == eol) {
+                batch_a[batch_count] = a;
+                batch_b[batch_count] = b;
+                if (++batch_count == batch_size) {
+                    flush_batch();
+                    if (out_failed)
+                        return end;
+                }
+            } else {
+                report_bad();
+            }
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    return p;
+}
+
+// process_fd: ファイル記述子 fd から読めるだけ読んで処理する
+static bool process_fd(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        // 通常のファイルはメモリにマップして，コピーせずに読む
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            const char *begin = (const char *)data;
+            parse_lines(begin, begin + st.st_size, true);
+            munmap(data, st.st_size);
+            return !out_failed;
+        }
+    }
+
+    // パイプなどは大きな単位で読み，行の途中で切れた部分は次に回す
+    // skipping: バッファに収まらない長い行の残りを読み捨てている途中か
+    static char in_buf[in_size];
+    size_t len = 0;
+    bool skipping = false;
+    for (;;) {
+        const ssize_t r = read(fd, in_buf + len, in_size - len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (r == 0) {
+            if (!skipping)
+                parse_lines(in_buf, in_buf + len, true);
+            return !out_failed;
+        }
+        len += r;
+
+        const char *begin = in_buf;
+        if (skipping) {
+            const char *eol = (const char *)memchr(in_buf, '\n', len);
+            if (eol == NULL) {
+                len = 0;
+                continue;
+            }
+            skipping = false;
+            begin = eol + 1;
+        }
+        const char *rest = parse_lines(begin, in_buf + len, false);
+        if (out_failed)
+            return false;
+        if (rest == in_buf && len == in_size) {
+            // バッファ全体が1行にも満たない: 数2つの行ではないので，次の改行まで読み捨てる
+            count_lines++;
+            line_no++;
+            report_bad();
+            skipping = true;
+            len = 0;
+            continue;
+        }
+        len = in_buf + len - rest;
+        memmove(in_buf, rest, len);
+    }
+}
 
 int main(int argc, char **argv) {
-    // コマンドラインから変数を読みとる
-    int a, b;
-    scanf("%d %d", &a, &b);
-
-    // 割り算
-    const double c = (double)a / (double)b;
-    printf("%d / %d = %f\n", a, b, c);
-}
\ No newline at end of file
+    // 引数があればそのファイルから，なければ標準入力から読みとる
+    int fd = STDIN_FILENO;
+    if (argc > 1) {
+        fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    bool ok = process_fd(fd);
+    flush_batch();
+    flush_output();
+    ok = ok && !out_failed;
+    if (fd != STDIN_FILENO)
+        close(fd);
+
+    if (count_zero > 0 || count_bad > 0)
+        fprintf(stderr, "%lld lines: %lld divided by zero, %lld skipped\n", count_lines, count_zero, count_bad);
+    return ok ? 0 : 1;
+}
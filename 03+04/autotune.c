@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(_NOT_USE_HEADER)
+#include "matrix.c"
+#else
+#include "matrix.h"
+#endif
+
+/*
+ * matrix.c の計算用関数のブロックの大きさと並列化の閾値を，このマシンで測って決め，
+ * プロファイルに書き出す．インストール時に一度だけ実行する．
+ *
+ *   autotune [出力先]
+ *
+ * 出力先を省略すると，環境変数 MAT_TUNE_PROFILE，それもなければ matrix_profile.txt．
+ * ライブラリは最初の計算のときに同じ場所からプロファイルを読み込む．
+ */
+
+// 1つの候補を測る回数 (一番速かった回の時間を使う)
+static const int repeat = 3;
+
+// 行列の積 (tile, task_min を測る)
+static matrix mul_a, mul_b, mul_c;
+// 連立方程式 (tile を測る)
+static matrix solve_a, solve_b, solve_x;
+// 転置 (trans_tile を測る)
+static matrix trans_a, trans_t;
+// 最小二乗法 (qr_tile を測る)
+static matrix lstsq_a, lstsq_b, lstsq_x;
+
+// alloc_random: rows x cols の行列を確保し，乱数で埋める
+static bool alloc_random(matrix *mat, int64_t rows, int64_t cols, mat_rand_kind kind, uint64_t seed)
+{
+    return mat_alloc(mat, rows, cols) && mat_fill_random(mat, kind, seed);
+}
+
+// time_mul: n x n の積 (mul_a, mul_b の左上) にかかる時間 [秒]
+static double time_mul(int64_t n)
+{
+    matrix a = {n, n, mul_a.elems}, b = {n, n, mul_b.elems}, c = {n, n, mul_c.elems};
+    double best = 1e30;
+    for (int r = 0; r < repeat; r++)
+    {
+        const double start = mat_wtime();
+        mat_mul(&c, a, b);
+        const double t = mat_wtime() - start;
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+// time_solve: solve_a を係数とする連立方程式にかかる時間 [秒]
+static double time_solve(void)
+{
+    double best = 1e30;
+    for (int r = 0; r < repeat; r++)
+    {
+        const double start = mat_wtime();
+        mat_solve(&solve_x, solve_a, solve_b);
+        const double t = mat_wtime() - start;
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+// time_trans: trans_a の転置にかかる時間 [秒]
+static double time_trans(void)
+{
+    double best = 1e30;
+    for (int r = 0; r < repeat; r++)
+    {
+        const double start = mat_wtime();
+        mat_trans(&trans_t, trans_a);
+        const double t = mat_wtime() - start;
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+// time_lstsq: lstsq_a を係数とする最小二乗法にかかる時間 [秒]
+static double time_lstsq(void)
+{
+    double best = 1e30;
+    for (int r = 0; r < repeat; r++)
+    {
+        const double start = mat_wtime();
+        mat_lstsq(&lstsq_x, lstsq_a, lstsq_b);
+        const double t = mat_wtime() - start;
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : getenv("MAT_TUNE_PROFILE");
+    if (path == NULL || path[0] == '\0')
+        path = MAT_TUNE_PROFILE;
+
+    const int64_t mul_n = 768, solve_n = 768, trans_n = 2048, lstsq_m = 2000, lstsq_n = 400;
+    bool ok = alloc_random(&mul_a, mul_n, mul_n, MAT_RAND_UNIFORM, 1) &&
+              alloc_random(&mul_b, mul_n, mul_n, MAT_RAND_UNIFORM, 2) &&
+              mat_alloc(&mul_c, mul_n, mul_n) &&
+              alloc_random(&solve_a, solve_n, solve_n, MAT_RAND_DIAG_DOMINANT, 3) &&
+              alloc_random(&solve_b, solve_n, 1, MAT_RAND_UNIFORM, 4) &&
+              mat_alloc(&solve_x, solve_n, 1) &&
+              alloc_random(&trans_a, trans_n, trans_n, MAT_RAND_UNIFORM, 5) &&
+              mat_alloc(&trans_t, trans_n, trans_n) &&
+              alloc_random(&lstsq_a, lstsq_m, lstsq_n, MAT_RAND_UNIFORM, 6) &&
+              alloc_random(&lstsq_b, lstsq_m, 1, MAT_RAND_UNIFORM, 7) &&
+              mat_alloc(&lstsq_x, lstsq_n, 1);
+    if (!ok)
+    {
+        fprintf(stderr, "autotune: cannot allocate matrices\n");
+        return 1;
+    }
+
+    // キャッシュの大きさから決めた値から始め，1つずつ測って置き換える
+    mat_tune_params params, trial;
+    mat_tune_heuristic(&params);
+    printf("heuristic: tile=%d task_min=%d trans_tile=%d qr_tile=%d\n",
+           params.tile, params.task_min, params.trans_tile, params.qr_tile);
+
+    // tile: タイルに分けた積とLU分解 (常に並列に計算するよう task_min=1 で測る)
+    {
+        static const int cand[] = {32, 48, 64, 96, 128, 192, 256};
+        double best = 1e30;
+        for (size_t i = 0; i < sizeof(cand) / sizeof(cand[0]); i++)
+        {
+            trial = params;
+            trial.tile = cand[i];
+            trial.task_min = 1;
+            mat_tune_set(&trial);
+            const double t = time_mul(mul_n) + time_solve();
+            printf("tile=%-4d %10.6f s\n", cand[i], t);
+            if (t < best)
+            {
+                best = t;
+                params.tile = cand[i];
+            }
+        }
+    }
+
+    // task_min: 同じタイル分割の積を，複数スレッドで並列に計算した方が
+    // 1スレッドで計算するより (測定のばらつきを超えて) 速くなる大きさ．
+    // それより大きい大きさでも常に速いものの中で一番小さいものを使う．
+    // 1スレッドしか使えなければ並列にしても速くならないので，候補より大きな値になる
+    {
+        static const int cand[] = {32, 48, 64, 96, 128, 192, 256, 384, 512, 768};
+        const int count = sizeof(cand) / sizeof(cand[0]);
+        int task_min = 2 * cand[count - 1];
+        for (int i = count - 1; i >= 0; i--)
+        {
+            trial = params;
+            trial.task_min = 1;
+            mat_tune_set(&trial);
+            const double t_par = time_mul(cand[i]);
+            trial.task_min = 1 << 20;
+            mat_tune_set(&trial);
+            const double t_serial = time_mul(cand[i]);
+            printf("n=%-4d parallel %10.6f s, serial %10.6f s\n", cand[i], t_par, t_serial);
+            if (t_par >= 0.95 * t_serial)
+                break;
+            task_min = cand[i];
+        }
+        params.task_min = task_min;
+    }
+
+    // trans_tile: 転置
+    {
+        static const int cand[] = {8, 16, 24, 32, 48, 64, 96, 128};
+        double best = 1e30;
+        for (size_t i = 0; i < sizeof(cand) / sizeof(cand[0]); i++)
+        {
+            trial = params;
+            trial.trans_tile = cand[i];
+            mat_tune_set(&trial);
+            const double t = time_trans();
+            printf("trans_tile=%-4d %10.6f s\n", cand[i], t);
+            if (t < best)
+            {
+                best = t;
+                params.trans_tile = cand[i];
+            }
+        }
+    }
+
+    // qr_tile: 最小二乗法 (ブロック化したハウスホルダーQR分解)
+    {
+        static const int cand[] = {8, 16, 24, 32, 48, 64};
+        double best = 1e30;
+        for (size_t i = 0; i < sizeof(cand) / sizeof(cand[0]); i++)
+        {
+            trial = params;
+            trial.qr_tile = cand[i];
+            mat_tune_set(&trial);
+            const double t = time_lstsq();
+            printf("qr_tile=%-4d %10.6f s\n", cand[i], t);
+            if (t < best)
+            {
+                best = t;
+                params.qr_tile = cand[i];
+            }
+        }
+    }
+
+    printf("tuned: tile=%d task_min=%d trans_tile=%d qr_tile=%d\n",
+           params.tile, params.task_min, params.trans_tile, params.qr_tile);
+    if (!mat_tune_save(path, &params))
+    {
+        perror(path);
+        return 1;
+    }
+    printf("profile written to %s\n", path);
+
+    mat_free(&mul_a);
+    mat_free(&mul_b);
+    mat_free(&mul_c);
+    mat_free(&solve_a);
+    mat_free(&solve_b);
+    mat_free(&solve_x);
+    mat_free(&trans_a);
+    mat_free(&trans_t);
+    mat_free(&lstsq_a);
+    mat_free(&lstsq_b);
+    mat_free(&lstsq_x);
+    return 0;
+}
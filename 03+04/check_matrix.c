@@ -1,10 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
 
-#ifdef _NOT_USE_HEADER
+#if defined(__cplusplus)
+#include "matrix.hpp"
+#elif defined(_NOT_USE_HEADER)
 #include "matrix.c"
 #else
 #include "matrix.h"
@@ -118,13 +121,32 @@ bool is_valid_mat(matrix mat)
 
 void mat_rand(matrix *mat)
 {
-    for (int i = 0; i < mat->rows; i++)
+    // シードはsrandで固定されたrand()からとるので，表示されたseedで再現できる
+    mat_fill_random(mat, MAT_RAND_UNIFORM, (uint64_t)rand());
+}
+
+// trace_count: 記録中のタスクの実行記録のうち，名前がnameのものの数
+int trace_count(const char *name)
+{
+    const int n = mat_trace_count < mat_trace_capacity ? mat_trace_count : mat_trace_capacity;
+    int count = 0;
+    for (int i = 0; i < n; i++)
     {
-        for (int j = 0; j < mat->cols; j++)
-        {
-            mat_elem(*mat, i, j) = rand() / (double)RAND_MAX;
-        }
+        if (strcmp(mat_trace_events[i].name, name) == 0)
+            count++;
     }
+    return count;
+}
+
+// pin_small_tiles: マシンに合わせたタイルの大きさに関係なくタスク分割が起きるよう，
+// 小さなタイルと閾値にする．元の値を*savedに保存する
+void pin_small_tiles(mat_tune_params *saved)
+{
+    mat_tune_get(saved);
+    mat_tune_params params = *saved;
+    params.tile = 32;
+    params.task_min = 32;
+    mat_tune_set(&params);
 }
 
 // ------------------------------------
@@ -155,6 +177,23 @@ TESTCASE(mat_alloc_and_free)
     mat_free(&A);
 }
 
+TESTCASE(mat_alloc_large)
+{
+    SAFE_DECLARE(matrix, A);
+
+    // バイト数が溢れる大きさは確保できない
+    ASSERT_FALSE(mat_alloc(&A, INT64_MAX / 2, 4));
+    ASSERT_FALSE(mat_alloc(&A, (int64_t)1 << 32, (int64_t)1 << 32));
+    ASSERT_TRUE(NULL == A.elems);
+
+    // huge pageで確保される大きさの行列が使えるかどうか
+    ASSERT_TRUE(mat_alloc(&A, 1024, 1024 + 7));
+    ASSERT_TRUE(is_valid_mat(A));
+    mat_rand(&A);
+    ASSERT_TRUE(mat_elem(A, A.rows - 1, A.cols - 1) >= 0.0);
+    mat_free(&A);
+}
+
 TESTCASE(mat_copy)
 {
     SAFE_DECLARE(matrix, A);
@@ -378,6 +417,54 @@ TESTCASE(mat_mul)
         }
     }
 
+    // 1行ずれて重なった行列に書き込んでも積が計算できるかどうか
+    SAFE_DECLARE(matrix, buf);
+    SAFE_DECLARE(matrix, sq);
+    mat_alloc(&buf, 11, 10);
+    mat_alloc(&sq, 10, 10);
+    mat_rand(&buf);
+    mat_rand(&sq);
+    matrix src = {10, 10, buf.elems};
+    matrix dst = {10, 10, buf.elems + 10};
+    SAFE_DECLARE(matrix, ref);
+    mat_alloc(&ref, 10, 10);
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < 10; j++)
+        {
+            double val = 0.0;
+            for (int k = 0; k < 10; k++)
+            {
+                val += mat_elem(src, i, k) * mat_elem(sq, k, j);
+            }
+            mat_elem(ref, i, j) = val;
+        }
+    }
+    ASSERT_TRUE(mat_mul(&dst, src, sq));
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQUAL(ref.elems[i], dst.elems[i]);
+    }
+
+    // 外積の入力が出力と重なっている場合
+    matrix col = {10, 1, buf.elems + 5};
+    matrix row = {1, 10, sq.elems};
+    for (int i = 0; i < 10; i++)
+    {
+        for (int j = 0; j < 10; j++)
+        {
+            mat_elem(ref, i, j) = col.elems[i] * row.elems[j];
+        }
+    }
+    ASSERT_TRUE(mat_mul(&dst, col, row));
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQUAL(ref.elems[i], dst.elems[i]);
+    }
+    mat_free(&buf);
+    mat_free(&sq);
+    mat_free(&ref);
+
     mat_free(&A);
     mat_free(&B);
     mat_free(&C);
@@ -540,162 +627,1158 @@ TESTCASE(mat_equal)
     mat_free(&B);
 }
 
-TESTCASE(mat_solve_simple)
+TESTCASE(mat_alloc_numa)
 {
     SAFE_DECLARE(matrix, A);
-    SAFE_DECLARE(matrix, x);
-    SAFE_DECLARE(matrix, b);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(matrix, C);
 
-    mat_alloc(&A, 3, 3);
-    mat_alloc(&x, 3, 1);
-    mat_alloc(&b, 3, 1);
+    // 不正な行列サイズ
+    ASSERT_FALSE(mat_alloc_numa(&A, 0, 10, MAT_NUMA_ROWS));
 
+    // 行ブロックごと・交互のどちらの配置でも0で初期化されているか
+    ASSERT_TRUE(mat_alloc_numa(&A, 123, 45, MAT_NUMA_ROWS));
+    ASSERT_TRUE(mat_alloc_numa(&B, 123, 45, MAT_NUMA_INTERLEAVE));
     ASSERT_TRUE(is_valid_mat(A));
-    ASSERT_TRUE(is_valid_mat(x));
-    ASSERT_TRUE(is_valid_mat(b));
-
-    mat_elem(A, 0, 0) = 2.0;
-    mat_elem(A, 0, 1) = 3.0;
-    mat_elem(A, 0, 2) = 1.0;
-    mat_elem(A, 1, 0) = 4.0;
-    mat_elem(A, 1, 1) = 1.0;
-    mat_elem(A, 1, 2) = -3.0;
-    mat_elem(A, 2, 0) = -1.0;
-    mat_elem(A, 2, 1) = 2.0;
-    mat_elem(A, 2, 2) = 1.0;
-
-    mat_elem(b, 0, 0) = 2.0;
-    mat_elem(b, 1, 0) = 3.0;
-    mat_elem(b, 2, 0) = 4.0;
+    ASSERT_TRUE(is_valid_mat(B));
+    for (int i = 0; i < A.rows * A.cols; i++)
+    {
+        ASSERT_EQUAL(0.0, A.elems[i]);
+        ASSERT_EQUAL(0.0, B.elems[i]);
+    }
 
-    // 正しく連立方程式が解けるかどうか
-    ASSERT_TRUE(mat_solve(&x, A, b));
+    // 通常の行列と同じように計算・解放できるか
+    mat_rand(&A);
+    mat_rand(&B);
+    mat_alloc(&C, 123, 45);
+    ASSERT_TRUE(mat_add(&C, A, B));
+    for (int i = 0; i < C.rows; i++)
+    {
+        for (int j = 0; j < C.cols; j++)
+        {
+            ASSERT_EQUAL(mat_elem(A, i, j) + mat_elem(B, i, j), mat_elem(C, i, j));
+        }
+    }
 
-    // 連立方程式の答えが正しいかどうか
-    ASSERT_EQUAL(mat_elem(x, 0, 0), -1.45);
-    ASSERT_EQUAL(mat_elem(x, 1, 0), 2.35);
-    ASSERT_EQUAL(mat_elem(x, 2, 0), -2.15);
+    mat_free(&A);
+    mat_free(&B);
+    mat_free(&C);
 }
 
-TESTCASE(mat_inverse_simple)
+TESTCASE(mat_mul_chain)
 {
-    SAFE_DECLARE(matrix, A);
-    SAFE_DECLARE(matrix, B);
-    SAFE_DECLARE(matrix, invA);
-
-    mat_alloc(&A, 3, 3);
-    mat_alloc(&B, 3, 3);
-    mat_alloc(&invA, 3, 3);
-
-    ASSERT_TRUE(is_valid_mat(A));
-    ASSERT_TRUE(is_valid_mat(invA));
-    ASSERT_TRUE(is_valid_mat(B));
+    // 形の大きく異なる行列の連鎖積 (左から順に計算すると無駄が多い)
+    const int dims[] = {30, 2, 40, 3, 50, 1, 20};
+    const int count = 6;
+    matrix mats[6];
+    memset(mats, 0, sizeof(mats));
+    for (int i = 0; i < count; i++)
+    {
+        mat_alloc(&mats[i], dims[i], dims[i + 1]);
+        mat_rand(&mats[i]);
+    }
 
-    // 正しく逆行列が求まる行列
-    mat_elem(A, 0, 0) = 1.0;
-    mat_elem(A, 0, 1) = 2.0;
-    mat_elem(A, 0, 2) = 3.0;
-    mat_elem(A, 1, 0) = 2.0;
-    mat_elem(A, 1, 1) = 2.0;
-    mat_elem(A, 1, 2) = 3.0;
-    mat_elem(A, 2, 0) = 3.0;
-    mat_elem(A, 2, 1) = 3.0;
-    mat_elem(A, 2, 2) = 3.0;
+    SAFE_DECLARE(matrix, C);
+    SAFE_DECLARE(matrix, D);
+    SAFE_DECLARE(matrix, T);
+    mat_alloc(&C, dims[0], dims[count]);
+    mat_alloc(&D, dims[0], dims[count]);
 
-    mat_elem(B, 0, 0) = -1.0;
-    mat_elem(B, 0, 1) = 1.0;
-    mat_elem(B, 0, 2) = 0.0;
-    mat_elem(B, 1, 0) = 1.0;
-    mat_elem(B, 1, 1) = -2.0;
-    mat_elem(B, 1, 2) = 1.0;
-    mat_elem(B, 2, 0) = 0.0;
-    mat_elem(B, 2, 1) = 1.0;
-    mat_elem(B, 2, 2) = -2.0 / 3.0;
+    // 形が不整合な並び
+    ASSERT_FALSE(mat_mul_chain(&C, mats + 1, 2, NULL));
 
-    // 正しく逆行列が求まるかどうか
-    ASSERT_TRUE(mat_inverse(&invA, A));
+    // 連鎖積が計算できるかどうか
+    SAFE_DECLARE(mat_chain_plan, plan);
+    ASSERT_TRUE(mat_mul_chain(&C, mats, count, &plan));
 
-    // 逆行列の値が正しいかどうか
-    for (int i = 0; i < 3; i++)
+    // 左から順に計算したときより演算回数が少ないかどうか
+    double naive = 0.0;
+    for (int i = 1; i < count; i++)
     {
-        for (int j = 0; j < 3; j++)
+        naive += 2.0 * dims[0] * dims[i] * dims[i + 1];
+    }
+    ASSERT_TRUE(plan.flops < naive);
+    ASSERT_TRUE(plan.buffers >= 1 && plan.buffers < count);
+    mat_chain_plan_free(&plan);
+
+    // 左から順にmat_mulで計算した結果と一致するかどうか
+    mat_alloc(&T, dims[0], dims[1]);
+    memcpy(T.elems, mats[0].elems, sizeof(double) * dims[0] * dims[1]);
+    for (int i = 1; i < count; i++)
+    {
+        SAFE_DECLARE(matrix, U);
+        mat_alloc(&U, dims[0], dims[i + 1]);
+        ASSERT_TRUE(mat_mul(&U, T, mats[i]));
+        mat_free(&T);
+        T = U;
+    }
+    for (int i = 0; i < C.rows; i++)
+    {
+        for (int j = 0; j < C.cols; j++)
         {
-            ASSERT_EQUAL(mat_elem(B, i, j), mat_elem(invA, i, j));
+            ASSERT_TRUE(fabs(mat_elem(T, i, j) - mat_elem(C, i, j)) < 1.0e-10);
         }
     }
 
-    // 同じ行列を入れても逆行列が求まるかどうか
-    ASSERT_TRUE(mat_inverse(&A, A));
+    // 行列1つ・2つの連鎖積
+    ASSERT_TRUE(mat_mul_chain(&mats[0], mats, 1, NULL));
+    mat_free(&D);
+    mat_alloc(&D, dims[0], dims[2]);
+    ASSERT_TRUE(mat_mul_chain(&D, mats, 2, NULL));
 
-    // 逆行列の値が正しいかどうか
-    for (int i = 0; i < 3; i++)
+    for (int i = 0; i < count; i++)
     {
-        for (int j = 0; j < 3; j++)
+        mat_free(&mats[i]);
+    }
+    mat_free(&C);
+    mat_free(&D);
+    mat_free(&T);
+}
+
+TESTCASE(mat_gemv)
+{
+    // 列の区間に分ける場合 (列が多い) と行を分ける場合 (縦長) の両方
+    const int shapes[3][2] = {{300, 1100}, {5000, 7}, {3, 4}};
+
+    for (int s = 0; s < 3; s++)
+    {
+        const int m = shapes[s][0], n = shapes[s][1];
+        SAFE_DECLARE(matrix, A);
+        SAFE_DECLARE(matrix, x);
+        SAFE_DECLARE(matrix, xt);
+        SAFE_DECLARE(matrix, y);
+        SAFE_DECLARE(matrix, yt);
+        SAFE_DECLARE(matrix, y0);
+        mat_alloc(&A, m, n);
+        mat_alloc(&x, n, 1);
+        mat_alloc(&xt, 1, m);
+        mat_alloc(&y, m, 1);
+        mat_alloc(&yt, 1, n);
+        mat_alloc(&y0, m, 1);
+        mat_rand(&A);
+        mat_rand(&x);
+        mat_rand(&xt);
+        mat_rand(&y);
+        mat_copy(&y0, y);
+
+        // y = 2 A x - y
+        ASSERT_TRUE(mat_gemv(&y, A, x, false, 2.0, -1.0));
+        for (int i = 0; i < m; i++)
         {
-            ASSERT_EQUAL(mat_elem(B, i, j), mat_elem(A, i, j));
+            double val = 0.0;
+            for (int j = 0; j < n; j++)
+            {
+                val += mat_elem(A, i, j) * mat_elem(x, j, 0);
+            }
+            ASSERT_TRUE(fabs(2.0 * val - mat_elem(y0, i, 0) - mat_elem(y, i, 0)) < 1.0e-10);
         }
+
+        // 行ベクトルと行列の積は転置したGEMVになる
+        ASSERT_TRUE(mat_mul(&yt, xt, A));
+        for (int j = 0; j < n; j++)
+        {
+            double val = 0.0;
+            for (int i = 0; i < m; i++)
+            {
+                val += mat_elem(xt, 0, i) * mat_elem(A, i, j);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(yt, 0, j)) < 1.0e-10);
+        }
+
+        // A += 0.5 x y^T (x は m 要素，y は n 要素)
+        mat_copy(&y0, y);
+        SAFE_DECLARE(matrix, B);
+        mat_alloc(&B, m, n);
+        mat_copy(&B, A);
+        ASSERT_TRUE(mat_ger(&A, 0.5, y, yt));
+        for (int i = 0; i < m; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                ASSERT_EQUAL(mat_elem(B, i, j) + 0.5 * mat_elem(y, i, 0) * mat_elem(yt, 0, j), mat_elem(A, i, j));
+            }
+        }
+
+        // ベクトルの長さが合わない
+        EXPECT_FALSE(mat_gemv(&y, A, y, false, 1.0, 0.0));
+        EXPECT_FALSE(mat_ger(&A, 1.0, x, yt));
+
+        mat_free(&A);
+        mat_free(&B);
+        mat_free(&x);
+        mat_free(&xt);
+        mat_free(&y);
+        mat_free(&yt);
+        mat_free(&y0);
     }
 
-    // 特異な行列
-    mat_elem(A, 0, 0) = 1.0;
-    mat_elem(A, 0, 1) = 2.0;
-    mat_elem(A, 0, 2) = 3.0;
-    mat_elem(A, 1, 0) = 2.0;
-    mat_elem(A, 1, 1) = 4.0;
-    mat_elem(A, 1, 2) = 6.0;
-    mat_elem(A, 2, 0) = 3.0;
-    mat_elem(A, 2, 1) = 6.0;
-    mat_elem(A, 2, 2) = 9.0;
+    // 結果を入力のベクトルに上書きしてもよい
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, x);
+    SAFE_DECLARE(matrix, x0);
+    mat_alloc(&A, 50, 50);
+    mat_alloc(&x, 50, 1);
+    mat_alloc(&x0, 50, 1);
+    mat_rand(&A);
+    mat_rand(&x);
+    mat_copy(&x0, x);
+    ASSERT_TRUE(mat_mul(&x, A, x));
+    for (int i = 0; i < 50; i++)
+    {
+        double val = 0.0;
+        for (int j = 0; j < 50; j++)
+        {
+            val += mat_elem(A, i, j) * mat_elem(x0, j, 0);
+        }
+        ASSERT_TRUE(fabs(val - mat_elem(x, i, 0)) < 1.0e-10);
+    }
 
-    // 逆行列が求まら「ない」かどうか
-    ASSERT_FALSE(mat_inverse(&invA, A));
+    // 列ベクトルと行ベクトルの積 (外積)
+    SAFE_DECLARE(matrix, r);
+    mat_alloc(&r, 1, 50);
+    mat_rand(&r);
+    ASSERT_TRUE(mat_mul(&A, x, r));
+    for (int i = 0; i < 50; i++)
+    {
+        for (int j = 0; j < 50; j++)
+        {
+            ASSERT_EQUAL(mat_elem(x, i, 0) * mat_elem(r, 0, j), mat_elem(A, i, j));
+        }
+    }
 
     mat_free(&A);
-    mat_free(&invA);
-    mat_free(&B);
+    mat_free(&x);
+    mat_free(&x0);
+    mat_free(&r);
 }
 
-TESTCASE(mat_inverse)
+#ifdef __cplusplus
+TESTCASE(matrix_raii)
 {
-    const int size = 100;
+    // mut() で書き込み終えた行列や at() で読んだ行列のコピーは要素を共有する
+    Matrix A(123, 45);
+    mat_rand(A.mut());
+    ASSERT_TRUE(1 == A.use_count());
+    const double a00 = A.at(0, 0);
+    Matrix B = A;
+    ASSERT_TRUE(2 == A.use_count());
+    ASSERT_TRUE(A.c().elems == B.c().elems);
+
+    // mut() の参照が生きている間のコピーは複製になる
+    {
+        Matrix::Mut m = A.mut();
+        ASSERT_TRUE(m->elems != B.c().elems);
+        Matrix S = A;
+        ASSERT_FALSE(S.c().elems == A.c().elems);
+        ASSERT_EQUAL(a00, S.at(0, 0));
+    }
+    Matrix S = A;
+    ASSERT_TRUE(S.c().elems == A.c().elems);
+    B = A;
+    ASSERT_TRUE(3 == A.use_count());
+    S = Matrix();
+
+    // 書き込むと複製され，元の行列は変わらない
+    B(0, 0) = a00 + 1.0;
+    ASSERT_TRUE(1 == A.use_count());
+    ASSERT_TRUE(1 == B.use_count());
+    ASSERT_FALSE(A.c().elems == B.c().elems);
+    ASSERT_EQUAL(a00, A.at(0, 0));
+    ASSERT_EQUAL(a00 + 1.0, B.at(0, 0));
+
+    // ムーブは要素を移すだけ
+    const double *elems = B.c().elems;
+    Matrix C = std::move(B);
+    ASSERT_TRUE(B.empty());
+    ASSERT_TRUE(C.c().elems == elems);
+    B = std::move(C);
+    ASSERT_TRUE(C.empty());
+    ASSERT_TRUE(B.c().elems == elems);
+
+    // 値で返す演算
+    Matrix D = A + B;
+    for (int i = 0; i < D.rows(); i++)
+    {
+        for (int j = 0; j < D.cols(); j++)
+        {
+            ASSERT_EQUAL(A.at(i, j) + B.at(i, j), D.at(i, j));
+        }
+    }
+    Matrix E = transpose(A) * A;
+    ASSERT_TRUE(E.rows() == 45 && E.cols() == 45);
+
+    // 部分行列への書き込みは元の行列に反映される
+    MatrixView V = D.view(10, 5, 3, 4);
+    V(2, 3) = 3.1415;
+    ASSERT_EQUAL(3.1415, D(12, 8));
+    ASSERT_FALSE(V.contiguous());
+    ASSERT_TRUE(D.view(10, 0, 3, D.cols()).contiguous());
+    bool thrown = false;
+    try
+    {
+        V.c();
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+
+    // 参照を渡した後のコピーは，その参照からの書き込みの影響を受けない
+    Matrix F = A;
+    MatrixView W = F.view(0, 0, 2, 2);
+    double &f11 = F(1, 1);
+    Matrix G = F;
+    ASSERT_FALSE(F.c().elems == G.c().elems);
+    W(0, 0) = 42.0;
+    f11 = 43.0;
+    ASSERT_EQUAL(42.0, F.at(0, 0));
+    ASSERT_EQUAL(A.at(0, 0), G.at(0, 0));
+    ASSERT_EQUAL(A.at(1, 1), G.at(1, 1));
+
+    // C の関数で書き込んだ後のコピーも要素を共有する
+    Matrix I(3, 3);
+    mat_ident(I.mut());
+    Matrix J = I;
+    ASSERT_TRUE(I.c().elems == J.c().elems);
+    ASSERT_EQUAL(1.0, J.at(2, 2));
+
+    // 大きさが合わない・空の行列の演算は std::invalid_argument
+    thrown = false;
+    try
+    {
+        Matrix H = A * A;
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+    thrown = false;
+    try
+    {
+        Matrix H = Matrix() + Matrix();
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+    thrown = false;
+    try
+    {
+        Matrix H(0, 3);
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    ASSERT_TRUE(thrown);
+}
+#endif
 
+TESTCASE(mat_fill_random)
+{
     SAFE_DECLARE(matrix, A);
     SAFE_DECLARE(matrix, B);
-    SAFE_DECLARE(matrix, invA);
-    SAFE_DECLARE(matrix, I);
-
-    // 非正方行列がエラーになる
-    mat_alloc(&A, size, size + 314);
-    mat_alloc(&invA, size + 314, size);
-    ASSERT_TRUE(is_valid_mat(A));
-    ASSERT_TRUE(is_valid_mat(invA));
-    ASSERT_FALSE(mat_inverse(&invA, A));
-    mat_free(&A);
-    mat_free(&invA);
 
-    // ランダムな正方行列を用意
-    mat_alloc(&A, size, size);
-    mat_alloc(&invA, size, size);
-    mat_alloc(&I, size, size);
-    mat_alloc(&B, size, size);
+    // 同じシードなら同じ行列になる
+    mat_alloc(&A, 123, 45);
+    mat_alloc(&B, 123, 45);
+    ASSERT_TRUE(mat_fill_random(&A, MAT_RAND_UNIFORM, 12345));
+    ASSERT_TRUE(mat_fill_random(&B, MAT_RAND_UNIFORM, 12345));
+    ASSERT_TRUE(mat_equal(A, B));
 
-    ASSERT_TRUE(is_valid_mat(A));
-    ASSERT_TRUE(is_valid_mat(invA));
-    ASSERT_TRUE(is_valid_mat(B));
-    ASSERT_TRUE(is_valid_mat(I));
+    // 一様乱数が [0, 1) に入っているかどうか
+    for (int i = 0; i < A.rows * A.cols; i++)
+    {
+        ASSERT_TRUE(A.elems[i] >= 0.0 && A.elems[i] < 1.0);
+    }
 
-    mat_rand(&A);
-    mat_ident(&I);
+    // 異なるシードなら異なる行列になる
+    ASSERT_TRUE(mat_fill_random(&B, MAT_RAND_UNIFORM, 54321));
+    ASSERT_FALSE(mat_equal(A, B));
 
-    // 逆行列が計算できるかどうか (ほぼ100%できるはず)
-    ASSERT_TRUE(mat_inverse(&invA, A));
+    // 正規乱数の平均と分散がおおよそ正しいかどうか
+    ASSERT_TRUE(mat_fill_random(&A, MAT_RAND_NORMAL, 12345));
+    double mean = 0.0, var = 0.0;
+    for (int i = 0; i < A.rows * A.cols; i++)
+    {
+        mean += A.elems[i];
+        var += A.elems[i] * A.elems[i];
+    }
+    mean /= A.rows * A.cols;
+    var = var / (A.rows * A.cols) - mean * mean;
+    EXPECT_TRUE(fabs(mean) < 0.1);
+    EXPECT_TRUE(fabs(var - 1.0) < 0.1);
+
+    // 非正方行列は対称正定値行列・対角優位行列にできない
+    ASSERT_FALSE(mat_fill_random(&A, MAT_RAND_SPD, 12345));
+    ASSERT_FALSE(mat_fill_random(&A, MAT_RAND_DIAG_DOMINANT, 12345));
+    mat_free(&A);
+    mat_free(&B);
 
-    // 逆行列との積が単位行列になるかどうか
-    mat_mul(&B, invA, A);
-    ASSERT_TRUE(mat_equal(B, I));
+    // 対称正定値行列は対称で，対角優位になっているか
+    const int size = 67;
+    mat_alloc(&A, size, size);
+    ASSERT_TRUE(mat_fill_random(&A, MAT_RAND_SPD, 777));
+    for (int i = 0; i < size; i++)
+    {
+        double sum = 0.0;
+        for (int j = 0; j < size; j++)
+        {
+            ASSERT_EQUAL(mat_elem(A, i, j), mat_elem(A, j, i));
+            if (i != j)
+                sum += fabs(mat_elem(A, i, j));
+        }
+        ASSERT_TRUE(mat_elem(A, i, i) > sum);
+    }
 
-    mat_mul(&B, A, invA);
-    ASSERT_TRUE(mat_equal(B, I));
+    // 対角優位行列が狭義対角優位になっているか
+    ASSERT_TRUE(mat_fill_random(&A, MAT_RAND_DIAG_DOMINANT, 777));
+    for (int i = 0; i < size; i++)
+    {
+        double sum = 0.0;
+        for (int j = 0; j < size; j++)
+        {
+            if (i != j)
+                sum += fabs(mat_elem(A, i, j));
+        }
+        ASSERT_TRUE(fabs(mat_elem(A, i, i)) > sum);
+    }
+
+#ifdef _OPENMP
+    // スレッド数を変えても同じ行列になるか
+    mat_alloc(&B, size, size);
+    const int threads = omp_get_max_threads();
+    const mat_rand_kind kinds[4] = {MAT_RAND_UNIFORM, MAT_RAND_NORMAL, MAT_RAND_SPD, MAT_RAND_DIAG_DOMINANT};
+    for (int k = 0; k < 4; k++)
+    {
+        omp_set_num_threads(1);
+        ASSERT_TRUE(mat_fill_random(&A, kinds[k], 2468));
+        omp_set_num_threads(5);
+        ASSERT_TRUE(mat_fill_random(&B, kinds[k], 2468));
+        omp_set_num_threads(threads);
+        EXPECT_TRUE(mat_equal(A, B));
+    }
+    mat_free(&B);
+#endif
+    mat_free(&A);
+}
+
+TESTCASE(mat_tune)
+{
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(matrix, C);
+    SAFE_DECLARE(matrix, D);
+    const char *path = "check_matrix_profile.txt";
+
+    mat_tune_params saved, params, loaded;
+    mat_tune_get(&saved);
+
+    // 書き出したプロファイルを読み直すと同じ値になるか
+    params.tile = 16;
+    params.task_min = 1;
+    params.trans_tile = 5;
+    params.qr_tile = 3;
+    ASSERT_TRUE(mat_tune_save(path, &params));
+    ASSERT_TRUE(mat_tune_load(path));
+    mat_tune_get(&loaded);
+    EXPECT_TRUE(loaded.tile == 16 && loaded.task_min == 1 && loaded.trans_tile == 5 && loaded.qr_tile == 3);
+
+    // 範囲外の値や読めない行があれば，パラメータを変えずにfalseを返すか
+    FILE *fp = fopen(path, "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "# comment\ntile=32\ntrans_tile=0\n");
+    fclose(fp);
+    EXPECT_FALSE(mat_tune_load(path));
+    fp = fopen(path, "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "tile=abc\n");
+    fclose(fp);
+    EXPECT_FALSE(mat_tune_load(path));
+    EXPECT_FALSE(mat_tune_load("no_such_directory/profile.txt"));
+    mat_tune_get(&loaded);
+    EXPECT_TRUE(loaded.tile == 16 && loaded.trans_tile == 5);
+    remove(path);
+
+    // 端数の出るパラメータでも結果が変わらないか
+    mat_alloc(&A, 70, 50);
+    mat_alloc(&B, 50, 60);
+    mat_alloc(&C, 70, 60);
+    mat_alloc(&D, 60, 70);
+    mat_rand(&A);
+    mat_rand(&B);
+    ASSERT_TRUE(mat_mul(&C, A, B));
+    for (int i = 0; i < C.rows; i++)
+    {
+        for (int j = 0; j < C.cols; j++)
+        {
+            double s = 0.0;
+            for (int k = 0; k < A.cols; k++)
+                s += mat_elem(A, i, k) * mat_elem(B, k, j);
+            ASSERT_EQUAL(s, mat_elem(C, i, j));
+        }
+    }
+    ASSERT_TRUE(mat_trans(&D, C));
+    for (int i = 0; i < C.rows; i++)
+    {
+        for (int j = 0; j < C.cols; j++)
+        {
+            ASSERT_EQUAL(mat_elem(C, i, j), mat_elem(D, j, i));
+        }
+    }
+
+    // キャッシュの大きさから決めた値も使える範囲にあるか
+    mat_tune_heuristic(&params);
+    EXPECT_TRUE(mat_tune_set(&params));
+    EXPECT_TRUE(mat_tune_set(&saved));
+
+    mat_free(&A);
+    mat_free(&B);
+    mat_free(&C);
+    mat_free(&D);
+}
+
+TESTCASE(ooc_mul)
+{
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(matrix, C);
+    SAFE_DECLARE(ooc_matrix, dA);
+    SAFE_DECLARE(ooc_matrix, dB);
+    SAFE_DECLARE(ooc_matrix, dC);
+
+    // タイルの大きさで割り切れない行列
+    const int tile = 16;
+    mat_alloc(&A, 37, 45);
+    mat_alloc(&B, 45, 29);
+    mat_alloc(&C, 37, 29);
+    mat_rand(&A);
+    mat_rand(&B);
+    ASSERT_TRUE(ooc_alloc(&dA, NULL, 37, 45, tile));
+    ASSERT_TRUE(ooc_alloc(&dB, NULL, 45, 29, tile));
+    ASSERT_TRUE(ooc_alloc(&dC, NULL, 37, 29, tile));
+    ASSERT_TRUE(ooc_store(&dA, A));
+    ASSERT_TRUE(ooc_store(&dB, B));
+
+    // サイズが不整合の行列
+    ASSERT_FALSE(ooc_mul(&dC, dB, dA));
+
+    // ディスク上で積が計算できるかどうか
+    ASSERT_TRUE(ooc_mul(&dC, dA, dB));
+    ASSERT_TRUE(ooc_load(&C, dC));
+
+    // 積の計算結果が正しいかどうか
+    for (int i = 0; i < C.rows; i++)
+    {
+        for (int j = 0; j < C.cols; j++)
+        {
+            double val = 0.0;
+            for (int k = 0; k < A.cols; k++)
+            {
+                val += mat_elem(A, i, k) * mat_elem(B, k, j);
+            }
+            ASSERT_EQUAL(val, mat_elem(C, i, j));
+        }
+    }
+
+    mat_free(&A);
+    mat_free(&B);
+    mat_free(&C);
+    ooc_free(&dA);
+    ooc_free(&dB);
+    ooc_free(&dC);
+}
+
+TESTCASE(ooc_rows)
+{
+    const char *path = "check_matrix_ooc.bin";
+    const int rows = 45, cols = 29, tile = 16;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(ooc_matrix, dA);
+    mat_alloc(&A, rows, cols);
+    mat_alloc(&B, rows, cols);
+    mat_rand(&A);
+
+    // タイルの境界にそろわない行のまとまりごとに書き込む
+    ASSERT_TRUE(ooc_alloc(&dA, path, rows, cols, tile));
+    const int cuts[4] = {0, 7, 30, rows};
+    for (int k = 0; k < 3; k++)
+    {
+        matrix part = {cuts[k + 1] - cuts[k], cols, &mat_elem(A, cuts[k], 0)};
+        ASSERT_TRUE(ooc_store_rows(&dA, cuts[k], part));
+    }
+    ASSERT_FALSE(ooc_store_rows(&dA, rows - 1, A));
+    ooc_free(&dA);
+
+    // 大きさの違う行列としては開けない
+    ASSERT_FALSE(ooc_open(&dA, path, rows + 20, cols, tile));
+
+    // 開き直して，別の区切り方で読み出す
+    ASSERT_TRUE(ooc_open(&dA, path, rows, cols, tile));
+    const int cuts2[3] = {0, 20, rows};
+    for (int k = 0; k < 2; k++)
+    {
+        matrix part = {cuts2[k + 1] - cuts2[k], cols, &mat_elem(B, cuts2[k], 0)};
+        ASSERT_TRUE(ooc_load_rows(&part, dA, cuts2[k]));
+    }
+    for (int i = 0; i < rows * cols; i++)
+    {
+        ASSERT_EQUAL(A.elems[i], B.elems[i]);
+    }
+
+    // LU分解に使うメモリが予算内に収まるタイルの大きさ
+    const int64_t budget = 1 << 20, n = 1000;
+    const int64_t t = ooc_lu_tile_for_budget(budget, n);
+    EXPECT_TRUE(t >= 8 && t % 8 == 0);
+    EXPECT_TRUE(((n + t - 1) / t + 1) * t * t * (int64_t)sizeof(double) <= budget);
+    EXPECT_TRUE(((n + t + 7) / (t + 8) + 1) * (t + 8) * (t + 8) * (int64_t)sizeof(double) > budget);
+
+    mat_free(&A);
+    mat_free(&B);
+    ooc_free(&dA);
+    remove(path);
+}
+
+TESTCASE(ooc_lu)
+{
+    const int size = 50;
+    const int tile = 16;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, LU);
+    SAFE_DECLARE(ooc_matrix, dA);
+
+    mat_alloc(&A, size, size);
+    mat_alloc(&LU, size, size);
+    mat_rand(&A);
+    ASSERT_TRUE(ooc_alloc(&dA, NULL, size, size, tile));
+    ASSERT_TRUE(ooc_store(&dA, A));
+
+    // ディスク上でLU分解ができるかどうか
+    int64_t piv[size];
+    ASSERT_TRUE(ooc_lu(&dA, piv));
+    ASSERT_TRUE(ooc_load(&LU, dA));
+
+    // 行交換したAとLUの積が一致するかどうか
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            swap(mat_elem(A, i, j), mat_elem(A, piv[i], j));
+        }
+    }
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            double val = 0.0;
+            for (int k = 0; k <= i && k <= j; k++)
+            {
+                val += (k == i ? 1.0 : mat_elem(LU, i, k)) * mat_elem(LU, k, j);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(A, i, j)) < 1.0e-9);
+        }
+    }
+
+    // 同じ行が2つある (特異な) 行列は分解できない
+    mat_rand(&A);
+    for (int j = 0; j < size; j++)
+    {
+        mat_elem(A, 40, j) = mat_elem(A, 3, j);
+    }
+    ASSERT_TRUE(ooc_store(&dA, A));
+    EXPECT_FALSE(ooc_lu(&dA, piv));
+
+    mat_free(&A);
+    mat_free(&LU);
+    ooc_free(&dA);
+}
+
+TESTCASE(mat_solve_simple)
+{
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, x);
+    SAFE_DECLARE(matrix, b);
+
+    mat_alloc(&A, 3, 3);
+    mat_alloc(&x, 3, 1);
+    mat_alloc(&b, 3, 1);
+
+    ASSERT_TRUE(is_valid_mat(A));
+    ASSERT_TRUE(is_valid_mat(x));
+    ASSERT_TRUE(is_valid_mat(b));
+
+    mat_elem(A, 0, 0) = 2.0;
+    mat_elem(A, 0, 1) = 3.0;
+    mat_elem(A, 0, 2) = 1.0;
+    mat_elem(A, 1, 0) = 4.0;
+    mat_elem(A, 1, 1) = 1.0;
+    mat_elem(A, 1, 2) = -3.0;
+    mat_elem(A, 2, 0) = -1.0;
+    mat_elem(A, 2, 1) = 2.0;
+    mat_elem(A, 2, 2) = 1.0;
+
+    mat_elem(b, 0, 0) = 2.0;
+    mat_elem(b, 1, 0) = 3.0;
+    mat_elem(b, 2, 0) = 4.0;
+
+    // 正しく連立方程式が解けるかどうか
+    ASSERT_TRUE(mat_solve(&x, A, b));
+
+    // 連立方程式の答えが正しいかどうか
+    ASSERT_EQUAL(mat_elem(x, 0, 0), -1.45);
+    ASSERT_EQUAL(mat_elem(x, 1, 0), 2.35);
+    ASSERT_EQUAL(mat_elem(x, 2, 0), -2.15);
+}
+
+TESTCASE(mat_mul_large)
+{
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(matrix, C);
+
+    // タイルに分けてタスク並列で計算される大きさの行列
+    mat_alloc(&A, 300, 280);
+    mat_alloc(&B, 280, 310);
+    mat_alloc(&C, 300, 310);
+    mat_rand(&A);
+    mat_rand(&B);
+
+    // タスクの実行記録をとりながら積が計算できるかどうか
+    mat_tune_params saved;
+    pin_small_tiles(&saved);
+    ASSERT_TRUE(mat_trace_begin(1 << 16));
+    ASSERT_TRUE(mat_mul(&C, A, B));
+    // 出力のタイル (32 x 32) 1枚につき1つのタスク
+    EXPECT_TRUE(trace_count("gemm") == 10 * 10);
+
+    // MAT_NUMA_ROWS では行の分担を固定して計算する (分担の境界でタイルが分かれると増える)．
+    // 要素ごとの足し算の順序は同じなので，結果も同じになる
+    SAFE_DECLARE(matrix, D);
+    mat_alloc(&D, 300, 310);
+    mat_set_numa_policy(MAT_NUMA_ROWS);
+    const int before = trace_count("gemm");
+    ASSERT_TRUE(mat_mul(&D, A, B));
+    mat_set_numa_policy(MAT_NUMA_NONE);
+    mat_tune_set(&saved);
+    EXPECT_TRUE(trace_count("gemm") - before >= 10 * 10);
+    EXPECT_TRUE(mat_equal(C, D));
+    mat_free(&D);
+
+    // 積の計算結果が正しいかどうか
+    for (int i = 0; i < C.rows; i++)
+    {
+        for (int j = 0; j < C.cols; j++)
+        {
+            double val = 0.0;
+            for (int k = 0; k < A.cols; k++)
+            {
+                val += mat_elem(A, i, k) * mat_elem(B, k, j);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(C, i, j)) < 1.0e-10);
+        }
+    }
+
+    // 実行記録を書き出せるかどうか
+    const char *path = "check_matrix_trace.json";
+    ASSERT_TRUE(mat_trace_dump(path));
+    FILE *fp = fopen(path, "r");
+    ASSERT_TRUE(fp != NULL);
+    char head[16] = {0};
+    ASSERT_TRUE(fread(head, 1, 14, fp) == 14);
+    ASSERT_TRUE(strcmp(head, "{\"traceEvents\"") == 0);
+    fclose(fp);
+    remove(path);
+
+    mat_free(&A);
+    mat_free(&B);
+    mat_free(&C);
+}
+
+TESTCASE(mat_solve)
+{
+    const int size = 200;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, x);
+    SAFE_DECLARE(matrix, b);
+
+    // 複数のタイルにまたがる行列と，複数列の右辺
+    mat_alloc(&A, size, size);
+    mat_alloc(&x, size, 3);
+    mat_alloc(&b, size, 3);
+    mat_fill_random(&A, MAT_RAND_DIAG_DOMINANT, 2024);
+    mat_rand(&b);
+
+    // 非正方行列は解けない
+    SAFE_DECLARE(matrix, R);
+    mat_alloc(&R, size, size + 1);
+    ASSERT_FALSE(mat_solve(&x, R, b));
+    mat_free(&R);
+
+    // 先読み (次のパネル分解と残りの更新の同時実行) を含むタスク分割で解く
+    mat_tune_params saved;
+    pin_small_tiles(&saved);
+    ASSERT_TRUE(mat_trace_begin(1 << 16));
+    const bool solved = mat_solve(&x, A, b);
+    mat_tune_set(&saved);
+    EXPECT_TRUE(trace_count("lu_panel") == 7);
+    EXPECT_TRUE(trace_count("lu_update") == 6 * 7 / 2);
+    mat_trace_end();
+    ASSERT_TRUE(solved);
+
+    // 残差 Ax - b が十分小さいかどうか
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            double val = 0.0;
+            for (int k = 0; k < size; k++)
+            {
+                val += mat_elem(A, i, k) * mat_elem(x, k, j);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(b, i, j)) < 1.0e-10);
+        }
+    }
+
+    // 複数のタイルにまたがる特異な行列は，パネルの途中で分解に失敗しても解けないと返す
+    for (int i = 0; i < size; i++)
+    {
+        mat_elem(A, i, 1) = 2.0 * mat_elem(A, i, 0);
+    }
+    pin_small_tiles(&saved);
+    const bool singular = mat_solve(&x, A, b);
+    mat_tune_set(&saved);
+    ASSERT_FALSE(singular);
+
+    mat_free(&A);
+    mat_free(&x);
+    mat_free(&b);
+}
+
+TESTCASE(mat_lstsq)
+{
+    const int rows = 500;
+    const int cols = 45;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, x);
+    SAFE_DECLARE(matrix, xt);
+    SAFE_DECLARE(matrix, b);
+
+    mat_alloc(&A, rows, cols);
+    mat_alloc(&x, cols, 2);
+    mat_alloc(&xt, cols, 2);
+    mat_alloc(&b, rows, 2);
+    mat_fill_random(&A, MAT_RAND_NORMAL, 31);
+    mat_rand(&xt);
+
+    // 横長の行列は解けない
+    SAFE_DECLARE(matrix, W);
+    mat_alloc(&W, cols, rows);
+    ASSERT_FALSE(mat_lstsq(&x, W, b));
+    mat_free(&W);
+
+    // 解がちょうど存在する場合はその解が求まるかどうか
+    mat_mul(&b, A, xt);
+    ASSERT_TRUE(mat_lstsq(&x, A, b));
+    for (int i = 0; i < cols; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(xt, i, j) - mat_elem(x, i, j)) < 1.0e-10);
+        }
+    }
+
+    // TSQRでも同じ解が求まるかどうか
+    ASSERT_TRUE(mat_lstsq_tsqr(&x, A, b, 4));
+    for (int i = 0; i < cols; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(xt, i, j) - mat_elem(x, i, j)) < 1.0e-10);
+        }
+    }
+
+    // 解が存在しない場合は残差が A の列と直交するかどうか (A^T (Ax - b) = 0)
+    mat_fill_random(&b, MAT_RAND_NORMAL, 32);
+    for (int mode = 0; mode < 2; mode++)
+    {
+        ASSERT_TRUE(mode == 0 ? mat_lstsq(&x, A, b) : mat_lstsq_tsqr(&x, A, b, 3));
+        for (int j = 0; j < 2; j++)
+        {
+            for (int c = 0; c < cols; c++)
+            {
+                double val = 0.0;
+                for (int i = 0; i < rows; i++)
+                {
+                    double r = -mat_elem(b, i, j);
+                    for (int k = 0; k < cols; k++)
+                    {
+                        r += mat_elem(A, i, k) * mat_elem(x, k, j);
+                    }
+                    val += mat_elem(A, i, c) * r;
+                }
+                ASSERT_TRUE(fabs(val) < 1.0e-9);
+            }
+        }
+    }
+
+    // 階数落ちの行列は解けない
+    for (int i = 0; i < rows; i++)
+    {
+        mat_elem(A, i, 1) = 2.0 * mat_elem(A, i, 0);
+    }
+    ASSERT_FALSE(mat_lstsq(&x, A, b));
+
+    mat_free(&A);
+    mat_free(&x);
+    mat_free(&xt);
+    mat_free(&b);
+}
+
+TESTCASE(band_solve)
+{
+    const int size = 300;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, x);
+    SAFE_DECLARE(matrix, y);
+    SAFE_DECLARE(matrix, b);
+    SAFE_DECLARE(band_matrix, T);
+    SAFE_DECLARE(band_matrix, B);
+
+    mat_alloc(&x, size, 2);
+    mat_alloc(&y, size, 2);
+    mat_alloc(&b, size, 2);
+    mat_rand(&b);
+
+    // 三重対角行列 (対角優位) をトーマス法で解けるかどうか
+    ASSERT_TRUE(band_alloc(&T, size, 1, 1));
+    for (int i = 0; i < size; i++)
+    {
+        band_elem(T, i, i) = 4.0;
+        if (i > 0)
+            band_elem(T, i, i - 1) = -1.0;
+        if (i + 1 < size)
+            band_elem(T, i, i + 1) = -1.5;
+    }
+    ASSERT_TRUE(band_solve_tridiag(&x, T, b));
+    ASSERT_TRUE(band_mul(&y, T, x));
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(y, i, j) - mat_elem(b, i, j)) < 1.0e-12);
+        }
+    }
+
+    // 結果を入力と同じ行列に書いても同じ積になるかどうか
+    memcpy(y.elems, x.elems, size * 2 * sizeof(double));
+    ASSERT_TRUE(band_mul(&y, T, y));
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(y, i, j) - mat_elem(b, i, j)) < 1.0e-12);
+        }
+    }
+
+    // 要素のバイト数が size_t に収まらない帯行列は確保しない
+    ASSERT_FALSE(band_alloc(&B, INT64_MAX / 4, 1, 1));
+
+    // 帯行列用のLU分解でも同じ解になるかどうか
+    ASSERT_TRUE(band_solve(&y, T, b));
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(x, i, j) - mat_elem(y, i, j)) < 1.0e-12);
+        }
+    }
+
+    // ピボット選択が必要な帯行列 (ところどころ対角が小さい) を密行列で作る
+    mat_alloc(&A, size, size);
+    mat_rand(&A);
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            if (j < i - 2 || j > i + 1)
+                mat_elem(A, i, j) = 0.0;
+        }
+        mat_elem(A, i, i) = (i % 3 == 0) ? 1.0e-3 : 4.0;
+    }
+
+    // 帯幅が正しく求まるかどうか
+    int64_t kl = 0, ku = 0;
+    ASSERT_TRUE(mat_bandwidth(A, &kl, &ku));
+    ASSERT_TRUE(kl == 2);
+    ASSERT_TRUE(ku == 1);
+
+    // 帯の外に要素がある帯行列には写せない
+    ASSERT_TRUE(band_alloc(&B, size, 1, 1));
+    ASSERT_FALSE(band_from_mat(&B, A));
+    band_free(&B);
+
+    ASSERT_TRUE(band_alloc(&B, size, kl, ku));
+    ASSERT_TRUE(band_from_mat(&B, A));
+    ASSERT_TRUE(band_solve(&x, B, b));
+
+    // 密行列のまま解いた結果と一致するかどうか
+    ASSERT_TRUE(mat_solve(&y, A, b));
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(x, i, j) - mat_elem(y, i, j)) < 1.0e-9);
+        }
+    }
+
+    // mat_solve が帯行列を見つけて解けるかどうか
+    mat_set_band_detect(true);
+    ASSERT_TRUE(mat_solve(&y, A, b));
+    mat_set_band_detect(false);
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            ASSERT_TRUE(fabs(mat_elem(x, i, j) - mat_elem(y, i, j)) < 1.0e-9);
+        }
+    }
+
+    mat_free(&A);
+    mat_free(&x);
+    mat_free(&y);
+    mat_free(&b);
+    band_free(&T);
+    band_free(&B);
+}
+
+TESTCASE(mat_inverse_simple)
+{
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(matrix, invA);
+
+    mat_alloc(&A, 3, 3);
+    mat_alloc(&B, 3, 3);
+    mat_alloc(&invA, 3, 3);
+
+    ASSERT_TRUE(is_valid_mat(A));
+    ASSERT_TRUE(is_valid_mat(invA));
+    ASSERT_TRUE(is_valid_mat(B));
+
+    // 正しく逆行列が求まる行列
+    mat_elem(A, 0, 0) = 1.0;
+    mat_elem(A, 0, 1) = 2.0;
+    mat_elem(A, 0, 2) = 3.0;
+    mat_elem(A, 1, 0) = 2.0;
+    mat_elem(A, 1, 1) = 2.0;
+    mat_elem(A, 1, 2) = 3.0;
+    mat_elem(A, 2, 0) = 3.0;
+    mat_elem(A, 2, 1) = 3.0;
+    mat_elem(A, 2, 2) = 3.0;
+
+    mat_elem(B, 0, 0) = -1.0;
+    mat_elem(B, 0, 1) = 1.0;
+    mat_elem(B, 0, 2) = 0.0;
+    mat_elem(B, 1, 0) = 1.0;
+    mat_elem(B, 1, 1) = -2.0;
+    mat_elem(B, 1, 2) = 1.0;
+    mat_elem(B, 2, 0) = 0.0;
+    mat_elem(B, 2, 1) = 1.0;
+    mat_elem(B, 2, 2) = -2.0 / 3.0;
+
+    // 正しく逆行列が求まるかどうか
+    ASSERT_TRUE(mat_inverse(&invA, A));
+
+    // 逆行列の値が正しいかどうか
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            ASSERT_EQUAL(mat_elem(B, i, j), mat_elem(invA, i, j));
+        }
+    }
+
+    // 同じ行列を入れても逆行列が求まるかどうか
+    ASSERT_TRUE(mat_inverse(&A, A));
+
+    // 逆行列の値が正しいかどうか
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            ASSERT_EQUAL(mat_elem(B, i, j), mat_elem(A, i, j));
+        }
+    }
+
+    // 特異な行列
+    mat_elem(A, 0, 0) = 1.0;
+    mat_elem(A, 0, 1) = 2.0;
+    mat_elem(A, 0, 2) = 3.0;
+    mat_elem(A, 1, 0) = 2.0;
+    mat_elem(A, 1, 1) = 4.0;
+    mat_elem(A, 1, 2) = 6.0;
+    mat_elem(A, 2, 0) = 3.0;
+    mat_elem(A, 2, 1) = 6.0;
+    mat_elem(A, 2, 2) = 9.0;
+
+    // 逆行列が求まら「ない」かどうか
+    ASSERT_FALSE(mat_inverse(&invA, A));
+
+    mat_free(&A);
+    mat_free(&invA);
+    mat_free(&B);
+}
+
+TESTCASE(mat_inverse)
+{
+    const int size = 100;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, B);
+    SAFE_DECLARE(matrix, invA);
+    SAFE_DECLARE(matrix, I);
+
+    // 非正方行列がエラーになる
+    mat_alloc(&A, size, size + 314);
+    mat_alloc(&invA, size + 314, size);
+    ASSERT_TRUE(is_valid_mat(A));
+    ASSERT_TRUE(is_valid_mat(invA));
+    ASSERT_FALSE(mat_inverse(&invA, A));
+    mat_free(&A);
+    mat_free(&invA);
+
+    // ランダムな正方行列を用意
+    mat_alloc(&A, size, size);
+    mat_alloc(&invA, size, size);
+    mat_alloc(&I, size, size);
+    mat_alloc(&B, size, size);
+
+    ASSERT_TRUE(is_valid_mat(A));
+    ASSERT_TRUE(is_valid_mat(invA));
+    ASSERT_TRUE(is_valid_mat(B));
+    ASSERT_TRUE(is_valid_mat(I));
+
+    mat_rand(&A);
+    mat_ident(&I);
+
+    // 逆行列が計算できるかどうか (ほぼ100%できるはず)
+    ASSERT_TRUE(mat_inverse(&invA, A));
+
+    // 逆行列との積が単位行列になるかどうか
+    mat_mul(&B, invA, A);
+    ASSERT_TRUE(mat_equal(B, I));
+
+    mat_mul(&B, A, invA);
+    ASSERT_TRUE(mat_equal(B, I));
 
     // 同じ行列をいれても逆行列が求まるかどうか
     ASSERT_TRUE(mat_inverse(&A, A));
@@ -709,6 +1792,265 @@ TESTCASE(mat_inverse)
     mat_free(&B);
 }
 
+TESTCASE(mat_lu_update)
+{
+    const int size = 150;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, A0);
+    SAFE_DECLARE(matrix, LU);
+    SAFE_DECLARE(matrix, U);
+    SAFE_DECLARE(matrix, V);
+    SAFE_DECLARE(matrix, x);
+    SAFE_DECLARE(matrix, b);
+    int64_t *piv = (int64_t *)malloc(size * sizeof(int64_t));
+    bool refactored;
+
+    // ピボット選択が必要な一般の行列
+    mat_alloc(&A, size, size);
+    mat_alloc(&A0, size, size);
+    mat_alloc(&LU, size, size);
+    mat_alloc(&U, size, 2);
+    mat_alloc(&V, size, 2);
+    mat_alloc(&x, size, 1);
+    mat_alloc(&b, size, 1);
+    mat_fill_random(&A, MAT_RAND_NORMAL, 37);
+    mat_copy(&A0, A);
+    mat_rand(&b);
+    mat_tune_params saved;
+    pin_small_tiles(&saved);
+    ASSERT_TRUE(mat_trace_begin(1 << 16));
+    ASSERT_TRUE(mat_lu(&LU, piv, A));
+    EXPECT_TRUE(trace_count("lu_update") > 0);
+    mat_trace_end();
+
+    // 階数2の更新を繰り返しても，更新後のAの方程式が解けるか
+    for (int step = 0; step < 5; step++)
+    {
+        mat_fill_random(&U, MAT_RAND_NORMAL, 100 + step);
+        mat_fill_random(&V, MAT_RAND_NORMAL, 200 + step);
+        mat_muls(&U, U, 0.1);
+        ASSERT_TRUE(mat_lu_update(&LU, piv, &A, U, V, &refactored));
+        EXPECT_FALSE(refactored);
+        ASSERT_TRUE(mat_lu_solve(&x, LU, piv, b));
+        for (int i = 0; i < size; i++)
+        {
+            double val = 0.0;
+            for (int k = 0; k < size; k++)
+            {
+                val += mat_elem(A, i, k) * mat_elem(x, k, 0);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(b, i, 0)) < 1.0e-8);
+        }
+        // A 自身も A + U V^T になっているか
+        for (int i = 0; i < size; i++)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                mat_elem(A0, i, j) += mat_elem(U, i, 0) * mat_elem(V, j, 0) + mat_elem(U, i, 1) * mat_elem(V, j, 1);
+                ASSERT_TRUE(fabs(mat_elem(A0, i, j) - mat_elem(A, i, j)) < 1.0e-12);
+            }
+        }
+    }
+
+    // 精度の閾値を0にすれば必ず分解し直す
+    mat_set_drift_tol(0.0);
+    ASSERT_TRUE(mat_lu_update(&LU, piv, &A, U, V, &refactored));
+    EXPECT_TRUE(refactored);
+    mat_set_drift_tol(1.0e-8);
+
+    // 0行目を消す更新をすると特異になる
+    mat_free(&U);
+    mat_free(&V);
+    mat_alloc(&U, size, 1);
+    mat_alloc(&V, size, 1);
+    memset(U.elems, 0, size * sizeof(double));
+    mat_elem(U, 0, 0) = 1.0;
+    for (int j = 0; j < size; j++)
+    {
+        mat_elem(V, j, 0) = -mat_elem(A, 0, j);
+    }
+    EXPECT_FALSE(mat_lu_update(&LU, piv, &A, U, V, &refactored));
+    EXPECT_TRUE(refactored);
+
+    // 大きさが合わない
+    EXPECT_FALSE(mat_lu_update(&LU, piv, &A, U, A0, NULL));
+    mat_tune_set(&saved);
+
+    free(piv);
+    mat_free(&A);
+    mat_free(&A0);
+    mat_free(&LU);
+    mat_free(&U);
+    mat_free(&V);
+    mat_free(&x);
+    mat_free(&b);
+}
+
+TESTCASE(mat_inverse_update)
+{
+    const int size = 100;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, invA);
+    SAFE_DECLARE(matrix, U);
+    SAFE_DECLARE(matrix, V);
+    SAFE_DECLARE(matrix, I);
+    bool refactored;
+
+    mat_alloc(&A, size, size);
+    mat_alloc(&invA, size, size);
+    mat_alloc(&U, size, 3);
+    mat_alloc(&V, size, 3);
+    mat_alloc(&I, size, size);
+    mat_fill_random(&A, MAT_RAND_DIAG_DOMINANT, 11);
+    ASSERT_TRUE(mat_inverse(&invA, A));
+
+    // 更新した逆行列と更新したAの積が単位行列になるか
+    for (int step = 0; step < 5; step++)
+    {
+        mat_fill_random(&U, MAT_RAND_UNIFORM, 300 + step);
+        mat_fill_random(&V, MAT_RAND_UNIFORM, 400 + step);
+        ASSERT_TRUE(mat_inverse_update(&invA, &A, U, V, &refactored));
+        EXPECT_FALSE(refactored);
+        ASSERT_TRUE(mat_mul(&I, invA, A));
+        for (int i = 0; i < size; i++)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                ASSERT_TRUE(fabs(mat_elem(I, i, j) - (i == j ? 1.0 : 0.0)) < 1.0e-9);
+            }
+        }
+    }
+
+    mat_set_drift_tol(0.0);
+    ASSERT_TRUE(mat_inverse_update(&invA, &A, U, V, &refactored));
+    EXPECT_TRUE(refactored);
+    mat_set_drift_tol(1.0e-8);
+
+    mat_free(&A);
+    mat_free(&invA);
+    mat_free(&U);
+    mat_free(&V);
+    mat_free(&I);
+}
+
+TESTCASE(mat_chol)
+{
+    const int size = 200;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, L);
+
+    mat_alloc(&A, size, size);
+    mat_alloc(&L, size, size);
+    mat_fill_random(&A, MAT_RAND_SPD, 11);
+
+    // 複数のタイルに分けたタスク (対角の分解・三角方程式・更新) で分解する
+    mat_tune_params saved;
+    pin_small_tiles(&saved);
+    ASSERT_TRUE(mat_trace_begin(1 << 16));
+    const bool factored = mat_chol(&L, A);
+    EXPECT_TRUE(trace_count("chol_factor") == 7);
+    EXPECT_TRUE(trace_count("chol_trsm") == 6 * 7 / 2);
+    EXPECT_TRUE(trace_count("chol_update") == 6 * 7 * 8 / 6);
+    mat_trace_end();
+    ASSERT_TRUE(factored);
+
+    // L が下三角で，L L^T が A になっているか
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            if (j > i)
+                ASSERT_TRUE(mat_elem(L, i, j) == 0.0);
+            double val = 0.0;
+            for (int k = 0; k < size; k++)
+            {
+                val += mat_elem(L, i, k) * mat_elem(L, j, k);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(A, i, j)) < 1.0e-9);
+        }
+    }
+
+    // Aに上書きしても同じ分解になるか
+    SAFE_DECLARE(matrix, B);
+    mat_alloc(&B, size, size);
+    mat_copy(&B, A);
+    ASSERT_TRUE(mat_chol(&B, B));
+    EXPECT_TRUE(mat_equal(B, L));
+    mat_free(&B);
+
+    // 途中のタイルの途中の列で正定値でないと分かる行列は分解できない
+    mat_elem(A, 100, 100) = -mat_elem(A, 100, 100);
+    EXPECT_FALSE(mat_chol(&L, A));
+    mat_tune_set(&saved);
+
+    mat_free(&A);
+    mat_free(&L);
+}
+
+TESTCASE(mat_chol_update)
+{
+    const int size = 120;
+
+    SAFE_DECLARE(matrix, A);
+    SAFE_DECLARE(matrix, L);
+    SAFE_DECLARE(matrix, L0);
+    SAFE_DECLARE(matrix, X);
+    bool refactored;
+
+    mat_alloc(&A, size, size);
+    mat_alloc(&L, size, size);
+    mat_alloc(&L0, size, size);
+    mat_alloc(&X, size, 2);
+    mat_fill_random(&A, MAT_RAND_SPD, 5);
+    mat_fill_random(&X, MAT_RAND_NORMAL, 6);
+
+    // 正定値でない行列は分解できない
+    mat_elem(A, 0, 0) = -mat_elem(A, 0, 0);
+    EXPECT_FALSE(mat_chol(&L, A));
+    mat_elem(A, 0, 0) = -mat_elem(A, 0, 0);
+
+    ASSERT_TRUE(mat_chol(&L, A));
+    mat_copy(&L0, L);
+
+    // 更新後の L L^T が A + X X^T になっているか
+    ASSERT_TRUE(mat_chol_update(&L, &A, X, false, &refactored));
+    EXPECT_FALSE(refactored);
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            double val = 0.0;
+            for (int k = 0; k < size; k++)
+            {
+                val += mat_elem(L, i, k) * mat_elem(L, j, k);
+            }
+            ASSERT_TRUE(fabs(val - mat_elem(A, i, j)) < 1.0e-10);
+            ASSERT_TRUE(j <= i || mat_elem(L, i, j) == 0.0);
+        }
+    }
+
+    // 同じ X で引き戻すと元の分解に戻るか
+    ASSERT_TRUE(mat_chol_update(&L, &A, X, true, &refactored));
+    EXPECT_FALSE(refactored);
+    for (int i = 0; i < size * size; i++)
+    {
+        ASSERT_TRUE(fabs(L.elems[i] - L0.elems[i]) < 1.0e-10);
+    }
+
+    // 正定値でなくなるほど引くとfalse
+    mat_muls(&X, X, 100.0);
+    EXPECT_FALSE(mat_chol_update(&L, &A, X, true, &refactored));
+    EXPECT_TRUE(refactored);
+
+    mat_free(&A);
+    mat_free(&L);
+    mat_free(&L0);
+    mat_free(&X);
+}
+
 int main()
 {
     TEST_INIT();
@@ -718,20 +2060,40 @@ int main()
 
     // 連立一次方程式と行列 (その2)
     RUN_TEST(mat_alloc_and_free);
+    RUN_TEST(mat_alloc_large);
+#ifdef __cplusplus
+    RUN_TEST(matrix_raii);
+#endif
     RUN_TEST(mat_copy);
     RUN_TEST(mat_add);
     RUN_TEST(mat_sub);
     RUN_TEST(mat_mul);
+    RUN_TEST(mat_mul_large);
+    RUN_TEST(mat_mul_chain);
+    RUN_TEST(mat_gemv);
     RUN_TEST(mat_muls);
     RUN_TEST(mat_ident);
     RUN_TEST(mat_trans);
     RUN_TEST(mat_equal);
+    RUN_TEST(mat_alloc_numa);
+    RUN_TEST(mat_fill_random);
+    RUN_TEST(mat_tune);
+    RUN_TEST(ooc_mul);
+    RUN_TEST(ooc_rows);
+    RUN_TEST(ooc_lu);
 
     // 連立一次方程式と行列 (その3)
     // 「その2」の課題に取り組んでいるときは適宜コメントアウトすること
     RUN_TEST(mat_solve_simple);
+    RUN_TEST(mat_solve);
+    RUN_TEST(band_solve);
     RUN_TEST(mat_inverse_simple);
     RUN_TEST(mat_inverse);
+    RUN_TEST(mat_inverse_update);
+    RUN_TEST(mat_lu_update);
+    RUN_TEST(mat_chol);
+    RUN_TEST(mat_chol_update);
+    RUN_TEST(mat_lstsq);
 
     TEST_FINISH();
 }
@@ -1,7 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#include <float.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // 要素を交換するマクロ
 #define swap(a, b)      \
@@ -20,8 +34,8 @@
  */
 typedef struct
 {
-    int rows;
-    int cols;
+    int64_t rows;
+    int64_t cols;
     double *elems;
 } matrix;
 
@@ -29,188 +43,3136 @@ typedef struct
 #define mat_elem(m, i, j) (m).elems[(i) * (m).cols + (j)]
 #define pmat_elem(m, i, j) (m)->elems[(i) * (m)->cols + (j)]
 
+// mat_overlap: aとbの要素のメモリが重なっているか
+static bool mat_overlap(matrix a, matrix b)
+{
+    const uintptr_t a0 = (uintptr_t)a.elems, a1 = (uintptr_t)(a.elems + a.rows * a.cols);
+    const uintptr_t b0 = (uintptr_t)b.elems, b1 = (uintptr_t)(b.elems + b.rows * b.cols);
+    return a0 < b1 && b0 < a1;
+}
+
 // ----------------------------------------------------------------------------
-// 行列演算用関数群
+// 計算用関数のチューニング用パラメータ
 // ----------------------------------------------------------------------------
 
-bool mat_same_size(matrix mat1, matrix mat2)
+/*
+ * ブロックの大きさと並列化の閾値
+ * tile: タスク並列の積・LU分解で使うタイルの一辺の長さ
+ * task_min: 積の計算量 (m*n*k) がこの3乗以上なら複数スレッドで計算する
+ * trans_tile: 転置で一度に扱う正方ブロックの一辺の長さ
+ * qr_tile: QR分解で一度に処理する列数 (パネル幅)
+ *
+ * 最初に使うときに，キャッシュの大きさから決めた値で初期化し，
+ * プロファイル (autotune で測定した結果) があればその値で上書きする．
+ * プロファイルは環境変数 MAT_TUNE_PROFILE で指定したファイル，
+ * 指定がなければカレントディレクトリの matrix_profile.txt．
+ */
+typedef struct
 {
-    if (mat1.cols != mat2.cols || mat1.rows != mat2.rows)
+    int tile;
+    int task_min;
+    int trans_tile;
+    int qr_tile;
+} mat_tune_params;
+
+#define MAT_TUNE_PROFILE "matrix_profile.txt"
+
+static mat_tune_params mat_tune = {64, 128, 32, 32};
+static bool mat_tune_ready = false;
+
+// cache_size: sysconfのキーnameのキャッシュの大きさ [バイト]．分からなければ0
+static long cache_size(int name)
+{
+    const long size = sysconf(name);
+    return size > 0 ? size : 0;
+}
+
+// round_tile: xを step の倍数に切り捨てて [lo, hi] に収める
+static int round_tile(double x, int step, int lo, int hi)
+{
+    int t = (int)x / step * step;
+    return t < lo ? lo : t > hi ? hi : t;
+}
+
+// mat_tune_heuristic: キャッシュの大きさから決めたパラメータを*paramsに代入する
+// キャッシュの大きさが分からない項目は既定値のまま
+void mat_tune_heuristic(mat_tune_params *params)
+{
+    const mat_tune_params def = {64, 128, 32, 32};
+    long l1 = 0, l2 = 0;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = cache_size(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+    *params = def;
+    // 積のタイルは a, b, c の3枚がL2に収まる大きさ
+    if (l2 > 0)
+        params->tile = round_tile(sqrt(l2 / (3.0 * sizeof(double))), 16, 32, 256);
+    // task_min はキャッシュではなくスレッドを起こす手間で決まるので，既定値のまま (autotune で測る)
+    if (l1 > 0)
+    {
+        // 転置は読み元と書き先の2ブロックがL1に収まる大きさ
+        params->trans_tile = round_tile(sqrt(l1 / (2.0 * sizeof(double))), 8, 8, 128);
+        // QRは jb x jb の T と，それを掛ける jb 列の行ブロックがL1に収まる大きさ
+        params->qr_tile = round_tile(sqrt(l1 / (2.0 * sizeof(double))), 8, 16, 64);
+    }
+}
+
+// mat_tune_valid: パラメータが使える範囲にあるか
+static bool mat_tune_valid(const mat_tune_params *params)
+{
+    return params->tile >= 4 && params->tile <= 4096 &&
+           params->task_min >= 1 && params->task_min <= 1 << 20 &&
+           params->trans_tile >= 1 && params->trans_tile <= 4096 &&
+           params->qr_tile >= 1 && params->qr_tile <= 4096;
+}
+
+// mat_tune_set: 計算用関数で使うパラメータを設定する (範囲外の値ならfalse)
+bool mat_tune_set(const mat_tune_params *params)
+{
+    if (!mat_tune_valid(params))
         return false;
+    mat_tune = *params;
+    mat_tune_ready = true;
     return true;
 }
-// mat_alloc: 行列要素用のメモリを確保する
-bool mat_alloc(matrix *mat, int rows, int cols)
+
+// mat_tune_load: プロファイルpathを読んでパラメータを設定する
+// 1行に "名前=値" を1つ書く．'#' から行末まではコメント，知らない名前は無視する．
+// 読めない・値が範囲外のときはfalseを返し，パラメータは変えない
+bool mat_tune_load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return false;
+
+    mat_tune_params params = mat_tune;
+    char line[256];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+        char key[64];
+        long value;
+        char rest;
+        const int n = sscanf(line, " %63[a-z_] = %ld %c", key, &value, &rest);
+        if (n <= 0)
+            continue;
+        if (n != 2 || value < 0 || value > INT32_MAX)
+        {
+            ok = false;
+            break;
+        }
+        if (strcmp(key, "tile") == 0)
+            params.tile = (int)value;
+        else if (strcmp(key, "task_min") == 0)
+            params.task_min = (int)value;
+        else if (strcmp(key, "trans_tile") == 0)
+            params.trans_tile = (int)value;
+        else if (strcmp(key, "qr_tile") == 0)
+            params.qr_tile = (int)value;
+    }
+    fclose(fp);
+    return ok && mat_tune_set(&params);
+}
+
+// mat_tune_save: パラメータparamsをプロファイルpathに書き出す
+bool mat_tune_save(const char *path, const mat_tune_params *params)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "# matrix.c tuning profile\n");
+    fprintf(fp, "tile=%d\n", params->tile);
+    fprintf(fp, "task_min=%d\n", params->task_min);
+    fprintf(fp, "trans_tile=%d\n", params->trans_tile);
+    fprintf(fp, "qr_tile=%d\n", params->qr_tile);
+    return fclose(fp) == 0;
+}
+
+// mat_params: 計算用関数で使うパラメータ (最初に呼ばれたときに初期化する)
+static const mat_tune_params *mat_params(void)
+{
+    if (!mat_tune_ready)
+    {
+#pragma omp critical(mat_tune)
+        if (!mat_tune_ready)
+        {
+            mat_tune_params params;
+            mat_tune_heuristic(&params);
+            mat_tune = params;
+            const char *path = getenv("MAT_TUNE_PROFILE");
+            mat_tune_load(path != NULL && path[0] != '\0' ? path : MAT_TUNE_PROFILE);
+            mat_tune_ready = true;
+        }
+    }
+    return &mat_tune;
+}
+
+// mat_tune_get: 計算用関数で使っているパラメータを*paramsに代入する
+void mat_tune_get(mat_tune_params *params)
+{
+    *params = *mat_params();
+}
+
+// ----------------------------------------------------------------------------
+// NUMAを考慮したメモリ配置
+// ----------------------------------------------------------------------------
+
+/*
+ * 行列要素のメモリ配置方針
+ * MAT_NUMA_NONE: mallocに任せる (最初に触ったスレッドのノードに全ページが載りやすい)
+ * MAT_NUMA_ROWS: 行ブロックごとに，その行を計算するスレッドのノードに置く
+ * MAT_NUMA_INTERLEAVE: 全ノードにページ単位で交互に置く
+ *
+ * MAT_NUMA_ROWSは計算用関数と同じ schedule(static) の行分割で
+ * 0初期化する (first touch) ことでページを配置する．
+ * ただしタスク並列のLU分解 (mat_solve, mat_inverse, mat_lu) はタスクを実行するスレッドが
+ * 決まらないので，この配置は効かない．大きな行列を分解するなら MAT_NUMA_INTERLEAVE が向く．
+ */
+typedef enum
+{
+    MAT_NUMA_NONE,
+    MAT_NUMA_ROWS,
+    MAT_NUMA_INTERLEAVE,
+} mat_numa_policy;
+
+// mat_alloc で使う配置方針
+static mat_numa_policy mat_numa_default = MAT_NUMA_NONE;
+
+// mat_set_numa_policy: mat_alloc で使う配置方針を設定する
+void mat_set_numa_policy(mat_numa_policy policy)
+{
+    mat_numa_default = policy;
+}
+
+// numa_interleave: [addr, addr+size) のページを全ノードに交互に置くようにする
+static bool numa_interleave(void *addr, size_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+    const int mpol_interleave = 3;     // MPOL_INTERLEAVE
+    const int mpol_f_mems_allowed = 4; // MPOL_F_MEMS_ALLOWED
+    unsigned long nodes[16];
+    const unsigned long maxnode = sizeof(nodes) * 8;
+    int mode;
+    memset(nodes, 0, sizeof(nodes));
+    if (syscall(SYS_get_mempolicy, &mode, nodes, maxnode, NULL, mpol_f_mems_allowed) != 0)
+        return false;
+    return syscall(SYS_mbind, addr, size, mpol_interleave, nodes, maxnode, 0) == 0;
+#else
+    (void)addr;
+    (void)size;
+    return false;
+#endif
+}
+
+// huge page の大きさ．これ以上の行列はhuge pageの境界にそろえて確保する
+#define MAT_HUGE_PAGE ((size_t)2 * 1024 * 1024)
+
+// mat_alloc_numa: 配置方針policyに従って行列要素用のメモリを確保する
+// MAT_NUMA_NONE 以外では要素は0で初期化される
+bool mat_alloc_numa(matrix *mat, int64_t rows, int64_t cols, mat_numa_policy policy)
 {
     if (rows <= 0 || cols <= 0)
         return false;
+    // バイト数が size_t に収まらない大きさは確保しない
+    if ((uint64_t)rows > SIZE_MAX / sizeof(double) / (uint64_t)cols)
+        return false;
+
+    // 大きな行列はhuge pageを使ってTLBミスを減らす．
+    // mbindもページ単位なので，NUMAの配置を指定するときはページ境界にそろえる
+    const size_t size = (size_t)rows * cols * sizeof(double);
+    const size_t page = size >= MAT_HUGE_PAGE ? MAT_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    const size_t bytes = (size + page - 1) / page * page;
+    void *p = NULL;
+    if (policy == MAT_NUMA_NONE && size < MAT_HUGE_PAGE)
+        p = malloc(size);
+    else if (posix_memalign(&p, page, bytes) != 0)
+        p = NULL;
+    if (p == NULL)
+        return false;
+#ifdef MADV_HUGEPAGE
+    if (size >= MAT_HUGE_PAGE)
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+
     mat->rows = rows;
     mat->cols = cols;
-    mat->elems = (double *)malloc(rows * cols * sizeof(double));
+    mat->elems = (double *)p;
+    if (policy == MAT_NUMA_NONE)
+        return true;
+    if (policy == MAT_NUMA_INTERLEAVE)
+        numa_interleave(p, bytes);
 
+    // 計算用関数と同じ行分割で最初に触る
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < rows; i++)
+    {
+        memset(&mat_elem(*mat, i, 0), 0, cols * sizeof(double));
+    }
     return true;
 }
 
-// mat_free: 使い終わった行列のメモリを解放する
-void mat_free(matrix *mat)
+// mat_pin_threads: OpenMPのスレッドを1つずつ別々のコアに固定する
+// スレッド番号順に，使用を許可されたCPUへ順に割り当てる．
+// 行分割は schedule(static) で決まるので，MAT_NUMA_ROWS で置いたページと
+// それを計算するスレッドが同じノードに載り続ける．
+bool mat_pin_threads(void)
 {
-    free(mat->elems);
-    mat->cols = 0;
-    mat->rows = 0;
-    mat->elems = NULL;
-}
+#if defined(__linux__) && defined(SYS_sched_getaffinity) && defined(SYS_sched_setaffinity)
+    unsigned long allowed[16];
+    memset(allowed, 0, sizeof(allowed));
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed) <= 0)
+        return false;
 
-// mat_print: 行列の中身を表示する
-void mat_print(matrix mat)
-{
-    if (mat.rows == 0 || mat.cols == 0 || mat.elems == NULL)
+    int cpus[sizeof(allowed) * 8];
+    int ncpus = 0;
+    for (int c = 0; c < (int)(sizeof(allowed) * 8); c++)
     {
-        fprintf(stderr, "Matrix is NULL or zero size!\n");
-        return;
+        if (allowed[c / (sizeof(unsigned long) * 8)] & (1UL << (c % (sizeof(unsigned long) * 8))))
+            cpus[ncpus++] = c;
+    }
+    if (ncpus == 0)
+        return false;
+
+    bool ok = true;
+#pragma omp parallel reduction(&& : ok)
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        const int c = cpus[tid % ncpus];
+        unsigned long mask[16];
+        memset(mask, 0, sizeof(mask));
+        mask[c / (sizeof(unsigned long) * 8)] = 1UL << (c % (sizeof(unsigned long) * 8));
+        ok = syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0;
     }
+    return ok;
+#else
+    return false;
+#endif
+}
 
-    for (int i = 0; i < mat.rows; i++)
+// ----------------------------------------------------------------------------
+// ブロック行列積の計算核
+// ----------------------------------------------------------------------------
+
+// gemm_block: c (m x n) に alpha * a (m x k) * b (k x n) を加える
+// lda, ldb, ldc は各配列の行の長さ (行列の一部分を指すときに使う)
+static void gemm_block(double *c, const double *a, const double *b,
+                       int64_t m, int64_t n, int64_t k, int64_t lda, int64_t ldb, int64_t ldc, double alpha)
+{
+    for (int64_t i = 0; i < m; i++)
     {
-        for (int j = 0; j < mat.cols; j++)
+        double *ci = c + i * ldc;
+        for (int64_t p = 0; p < k; p++)
         {
-            printf("%6.4f%s", mat_elem(mat, i, j), (j == mat.cols - 1) ? "\n" : "  ");
+            const double aip = alpha * a[i * lda + p];
+            const double *bp = b + p * ldb;
+#pragma omp simd
+            for (int64_t j = 0; j < n; j++)
+            {
+                ci[j] += aip * bp[j];
+            }
         }
     }
 }
 
-// mat_copy: srcの中身を*dstにコピーする
-bool mat_copy(matrix *dst, matrix src)
+// ----------------------------------------------------------------------------
+// タイル単位のタスク並列
+// ----------------------------------------------------------------------------
+
+/*
+ * 行列をタイル (tile x tile) に分け，タイルに対する処理をOpenMPのタスクにする．
+ * タスク間の依存関係は，読み書きするタイル列を depend 節で宣言して表す．
+ * スケジューリング (空いたスレッドによるタスクの横取りを含む) はOpenMPの実行時に任せる．
+ * LU分解では，次のパネル分解が前のパネルの残りの更新と同時に進む (lookahead)．
+ * コレスキー分解は対角タイルの分解・その下のタイルの三角方程式・残りのタイルの更新を
+ * それぞれタイルごとのタスクにし，読み書きするタイルを depend 節で宣言する．
+ *
+ * タスクはどのスレッドで実行されるか決まらないので，タスクには MAT_NUMA_ROWS の
+ * 行ブロック配置は効かない．行列積は MAT_NUMA_ROWS のときだけ行の分担を固定した
+ * gemm_tiles で，それ以外は出力タイルごとのタスク (gemm_tasks) で計算する．
+ */
+
+/*
+ * タスクの実行記録
+ * name: タスクの種類
+ * thread: 実行したスレッドの番号
+ * start, end: 開始・終了時刻 [秒]
+ */
+typedef struct
 {
-    if (!mat_same_size(*dst, src))
-        return false;
-    if (!mat_alloc(dst, src.rows, src.cols))
+    const char *name;
+    int thread;
+    double start;
+    double end;
+} mat_trace_event;
+
+static mat_trace_event *mat_trace_events = NULL;
+static int mat_trace_count = 0;
+static int mat_trace_capacity = 0;
+
+// mat_wtime: 経過時間 [秒]
+static double mat_wtime(void)
+{
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// mat_trace_begin: タスクの実行記録を始める．capacity個を超えた分は捨てる
+bool mat_trace_begin(int capacity)
+{
+    free(mat_trace_events);
+    mat_trace_count = 0;
+    mat_trace_capacity = 0;
+    mat_trace_events = (mat_trace_event *)malloc(capacity * sizeof(mat_trace_event));
+    if (mat_trace_events == NULL)
         return false;
-    memcpy(dst->elems, src.elems, dst->rows * dst->cols * sizeof(double));
+    mat_trace_capacity = capacity;
     return true;
 }
 
-// mat_add: mat1+mat2を*resに代入する
-bool mat_add(matrix *res, matrix mat1, matrix mat2)
+// trace_record: start から今までに実行したタスクを記録する
+static void trace_record(const char *name, double start)
 {
-    if (!mat_same_size(*res, mat1) || !mat_same_size(mat1, mat2) || !mat_same_size(mat2, *res))
+    if (mat_trace_events == NULL)
+        return;
+    int idx;
+#pragma omp atomic capture
+    idx = mat_trace_count++;
+    if (idx >= mat_trace_capacity)
+        return;
+    mat_trace_event *e = &mat_trace_events[idx];
+    e->name = name;
+#ifdef _OPENMP
+    e->thread = omp_get_thread_num();
+#else
+    e->thread = 0;
+#endif
+    e->start = start;
+    e->end = mat_wtime();
+}
+
+// mat_trace_dump: 記録したタスクをChromeのトレース形式 (JSON) でpathに書き出し，記録を終える
+// chrome://tracing や Perfetto で時系列を表示できる
+bool mat_trace_dump(const char *path)
+{
+    if (mat_trace_events == NULL)
+        return false;
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
         return false;
-    for (int i = 0; i < res->rows * res->cols; i++)
+    const int count = mat_trace_count < mat_trace_capacity ? mat_trace_count : mat_trace_capacity;
+    double origin = count > 0 ? mat_trace_events[0].start : 0.0;
+    for (int i = 1; i < count; i++)
     {
-        res->elems[i] = mat1.elems[i] + mat2.elems[i];
+        origin = fmin(origin, mat_trace_events[i].start);
+    }
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (int i = 0; i < count; i++)
+    {
+        const mat_trace_event *e = &mat_trace_events[i];
+        fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                e->name, e->thread, (e->start - origin) * 1.0e6, (e->end - e->start) * 1.0e6,
+                i == count - 1 ? "" : ",");
     }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+
+    free(mat_trace_events);
+    mat_trace_events = NULL;
+    mat_trace_count = 0;
+    mat_trace_capacity = 0;
     return true;
 }
 
-// mat_sub: mat1-mat2を*resに代入する
-bool mat_sub(matrix *res, matrix mat1, matrix mat2)
+// mat_trace_end: 実行記録を書き出さずに記録をやめる
+void mat_trace_end(void)
 {
-    if (!mat_same_size(*res, mat1) || !mat_same_size(mat1, mat2) || !mat_same_size(mat2, *res))
-        return false;
-    for (int i = 0; i < res->rows * res->cols; i++)
+    free(mat_trace_events);
+    mat_trace_events = NULL;
+    mat_trace_count = 0;
+    mat_trace_capacity = 0;
+}
+
+// gemm_tile: *resの行i0から m 行，列j0から n 列のタイルに mat1 と mat2 の積を代入し，実行記録 "gemm" を残す
+static void gemm_tile(matrix *res, matrix mat1, matrix mat2, int64_t i0, int64_t j0, int64_t m, int64_t n)
+{
+    const int64_t t = mat_params()->tile;
+    const double start = mat_wtime();
+    for (int64_t i = 0; i < m; i++)
     {
-        res->elems[i] = mat1.elems[i] - mat2.elems[i];
+        memset(&pmat_elem(res, i0 + i, j0), 0, n * sizeof(double));
     }
-    return true;
+    for (int64_t k0 = 0; k0 < mat1.cols; k0 += t)
+    {
+        const int64_t k = mat1.cols - k0 < t ? mat1.cols - k0 : t;
+        gemm_block(&pmat_elem(res, i0, j0), &mat_elem(mat1, i0, k0), &mat_elem(mat2, k0, j0),
+                   m, n, k, mat1.cols, mat2.cols, res->cols, 1.0);
+    }
+    trace_record("gemm", start);
 }
 
-// mat_mul: mat1とmat2の行列積を*resに代入する
-bool mat_mul(matrix *res, matrix mat1, matrix mat2)
+// gemm_tiles: mat1とmat2の行列積を*resに代入する (MAT_NUMA_ROWS 用)
+// 各スレッドは，mat_alloc_numa の first touch と同じ schedule(static) の行分割で受け持つ行を決め，
+// その行の範囲をタイルに分けて計算する．MAT_NUMA_ROWS で置いた *res と mat1 の行は，
+// それを置いたスレッドが読み書きする．タイルの計算量はそろっているので横取りは必要ない．
+// parallel が false ならスレッドを起こさず，同じタイル順に1スレッドで計算する
+static void gemm_tiles(matrix *res, matrix mat1, matrix mat2, bool parallel)
 {
-    if (mat1.cols != mat2.rows || res->rows != mat1.rows || res->cols != mat2.cols)
-        return false;
-    matrix tmp;
-    mat_alloc(&tmp, res->rows, res->cols);
-    for (int i = 0; i < res->rows; i++)
+    const int64_t t = mat_params()->tile;
+#pragma omp parallel if (parallel)
     {
-        for (int j = 0; j < res->cols; j++)
+        // 受け持つ行の範囲 [lo, hi)
+        int64_t lo = res->rows, hi = 0;
+#pragma omp for schedule(static) nowait
+        for (int64_t i = 0; i < res->rows; i++)
+        {
+            lo = i < lo ? i : lo;
+            hi = i + 1;
+        }
+        for (int64_t i0 = lo; i0 < hi; i0 += t)
         {
-            mat_elem(tmp, i, j) = 0.0;
-            for (int k = 0; k < mat1.cols; k++)
+            for (int64_t j0 = 0; j0 < res->cols; j0 += t)
             {
-                mat_elem(tmp, i, j) += mat_elem(mat1, i, k) * mat_elem(mat2, k, j);
+                const int64_t m = hi - i0 < t ? hi - i0 : t;
+                const int64_t n = res->cols - j0 < t ? res->cols - j0 : t;
+                gemm_tile(res, mat1, mat2, i0, j0, m, n);
             }
         }
     }
-    memcpy(res->elems, tmp.elems, res->rows * res->cols * sizeof(double));
-    mat_free(&tmp);
-    return true;
 }
 
-// mat_muls: matをc倍（スカラー倍）した結果を*resに代入する
-bool mat_muls(matrix *res, matrix mat, double c)
+// gemm_tasks: mat1とmat2の行列積を*resに代入する．*resのタイルごとに1タスク
+// 出力タイルどうしに依存関係はないので，空いたスレッドが残りのタイルを横取りして計算する．
+// parallel が false ならスレッドを起こさず，同じタイル順に1スレッドで計算する
+static void gemm_tasks(matrix *res, matrix mat1, matrix mat2, bool parallel)
 {
-    if (!mat_same_size(*res, mat))
-        return false;
-    for (int i = 0; i < res->rows * res->cols; i++)
+    const int64_t t = mat_params()->tile;
+#pragma omp parallel if (parallel)
+#pragma omp single
+    for (int64_t i0 = 0; i0 < res->rows; i0 += t)
     {
-        res->elems[i] = mat.elems[i] * c;
+        for (int64_t j0 = 0; j0 < res->cols; j0 += t)
+        {
+            const int64_t m = res->rows - i0 < t ? res->rows - i0 : t;
+            const int64_t n = res->cols - j0 < t ? res->cols - j0 : t;
+#pragma omp task firstprivate(i0, j0, m, n)
+            gemm_tile(res, mat1, mat2, i0, j0, m, n);
+        }
     }
-    return true;
 }
 
-// mat_trans: matの転置行列を*resに代入する
-bool mat_trans(matrix *res, matrix mat)
+// lu_swap_rows: *matのr1行目とr2行目を，列c0から幅widthだけ交換する
+static void lu_swap_rows(matrix *mat, int64_t r1, int64_t r2, int64_t c0, int64_t width)
 {
-    if (res->cols != mat.rows || res->rows != mat.cols)
-        return false;
-    for (int i = 0; i < mat.rows; i++)
+    if (r1 == r2)
+        return;
+    for (int64_t j = c0; j < c0 + width; j++)
+    {
+        swap(pmat_elem(mat, r1, j), pmat_elem(mat, r2, j));
+    }
+}
+
+// lu_panel: 列c0から幅widthのパネルを，対角から下についてピボット選択付きでLU分解する
+// 絶対値がtol以下のピボットしかなければ特異とみなしてfalseを返す．
+// そのときもこのパネルの更新タスクは実行されるので，残りの列のpivは交換なしにしておく
+static bool lu_panel(matrix *A, int64_t *piv, int64_t c0, int64_t width, double tol)
+{
+    const int64_t n = A->rows;
+    for (int64_t c = c0; c < c0 + width; c++)
     {
-        for (int j = 0; j < mat.cols; j++)
+        int64_t p = c;
+        for (int64_t r = c + 1; r < n; r++)
+        {
+            if (fabs(pmat_elem(A, r, c)) > fabs(pmat_elem(A, p, c)))
+                p = r;
+        }
+        piv[c] = p;
+        lu_swap_rows(A, c, p, c0, width);
+
+        const double d = pmat_elem(A, c, c);
+        if (fabs(d) <= tol)
+        {
+            for (int64_t r = c + 1; r < c0 + width; r++)
+            {
+                piv[r] = r;
+            }
+            return false;
+        }
+        for (int64_t r = c + 1; r < n; r++)
         {
-            mat_elem(*res, j, i) = mat_elem(mat, i, j);
+            const double l = (pmat_elem(A, r, c) /= d);
+            for (int64_t j = c + 1; j < c0 + width; j++)
+            {
+                pmat_elem(A, r, j) -= l * pmat_elem(A, c, j);
+            }
         }
     }
     return true;
 }
 
-// mat_unit: 単位行列を与える
-bool mat_ident(matrix *mat)
+// lu_update: パネル(列c0から幅width)の分解結果をタイル列(列cjから幅wj)に適用する
+// パネルより右の列には行交換・前進代入・行列積による更新を，左の列には行交換だけを行う
+static void lu_update(matrix *A, const int64_t *piv, int64_t c0, int64_t width, int64_t cj, int64_t wj)
 {
-    if (mat->cols != mat->rows)
+    for (int64_t c = c0; c < c0 + width; c++)
+    {
+        lu_swap_rows(A, c, piv[c], cj, wj);
+    }
+    if (cj < c0)
+        return;
+
+    // U = L^{-1} A (Lは対角ブロックの単位下三角)
+    for (int64_t i = c0 + 1; i < c0 + width; i++)
+    {
+        for (int64_t p = c0; p < i; p++)
+        {
+            const double l = pmat_elem(A, i, p);
+            for (int64_t j = cj; j < cj + wj; j++)
+            {
+                pmat_elem(A, i, j) -= l * pmat_elem(A, p, j);
+            }
+        }
+    }
+
+    // 残りの行を更新
+    const int64_t r0 = c0 + width;
+    if (r0 < A->rows)
+    {
+        gemm_block(&pmat_elem(A, r0, cj), &pmat_elem(A, r0, c0), &pmat_elem(A, c0, cj),
+                   A->rows - r0, wj, width, A->cols, A->cols, A->cols, -1.0);
+    }
+}
+
+// lu_tasks: 正方行列*Aをピボット選択付きでLU分解し，LとUを*Aに上書きする
+// piv[i]: i行目と交換した行の番号
+static bool lu_tasks(matrix *A, int64_t *piv)
+{
+    const int64_t n = A->rows;
+    const int64_t t = mat_params()->tile;
+    const int64_t nt = (n + t - 1) / t;
+
+    double amax = 0.0;
+    for (int64_t i = 0; i < n * n; i++)
+    {
+        amax = fmax(amax, fabs(A->elems[i]));
+    }
+    const double tol = n * DBL_EPSILON * amax;
+
+    // タイル列ごとの依存関係を表すための目印
+    char *dep = (char *)malloc(nt);
+    if (dep == NULL)
         return false;
-    for (int i = 0; i < mat->rows; i++)
+    bool ok = true;
+
+#pragma omp parallel
+#pragma omp single
+    for (int64_t k = 0; k < nt; k++)
     {
-        for (int j = 0; j < mat->cols; j++)
+        const int64_t c0 = k * t;
+        const int64_t width = n - c0 < t ? n - c0 : t;
+#pragma omp task firstprivate(c0, width) depend(inout : dep[k]) shared(ok)
         {
-            if (i == j)
+            const double start = mat_wtime();
+            if (!lu_panel(A, piv, c0, width, tol))
             {
-                mat_elem(*mat, i, j) = 1;
+#pragma omp atomic write
+                ok = false;
             }
-            else
+            trace_record("lu_panel", start);
+        }
+        for (int64_t j = 0; j < nt; j++)
+        {
+            if (j == k)
+                continue;
+            const int64_t cj = j * t;
+            const int64_t wj = n - cj < t ? n - cj : t;
+#pragma omp task firstprivate(c0, width, cj, wj) depend(in : dep[k]) depend(inout : dep[j])
             {
-                mat_elem(*mat, i, j) = 0;
+                const double start = mat_wtime();
+                lu_update(A, piv, c0, width, cj, wj);
+                trace_record(cj > c0 ? "lu_update" : "lu_swap", start);
             }
         }
     }
-    return true;
+
+    free(dep);
+    return ok;
 }
 
-// mat_equal: mat1とmat2が等しければtrueを返す
-bool mat_equal(matrix mat1, matrix mat2)
+// lu_solve_tasks: LU分解の結果を使って LU x = b を解き，*bに上書きする．bの列ブロックごとに1タスク
+static void lu_solve_tasks(matrix LU, const int64_t *piv, matrix *b)
 {
-    if (!mat_same_size(mat1, mat2))
-        return false;
-    for (int i = 0; i < mat1.rows; i++)
+    const int64_t n = LU.rows;
+    const int64_t t = mat_params()->tile;
+#pragma omp parallel
+#pragma omp single
+    for (int64_t c0 = 0; c0 < b->cols; c0 += t)
     {
-        for (int j = 0; j < mat1.cols; j++)
+#pragma omp task firstprivate(c0)
         {
-            if (mat_elem(mat1, i, j) != mat_elem(mat2, i, j))
+            const double start = mat_wtime();
+            const int64_t width = b->cols - c0 < t ? b->cols - c0 : t;
+            for (int64_t i = 0; i < n; i++)
             {
-                return false;
+                lu_swap_rows(b, i, piv[i], c0, width);
+            }
+            // 前進代入
+            for (int64_t i = 1; i < n; i++)
+            {
+                for (int64_t p = 0; p < i; p++)
+                {
+                    const double l = mat_elem(LU, i, p);
+                    for (int64_t j = c0; j < c0 + width; j++)
+                    {
+                        pmat_elem(b, i, j) -= l * pmat_elem(b, p, j);
+                    }
+                }
+            }
+            // 後退代入
+            for (int64_t i = n - 1; i >= 0; i--)
+            {
+                for (int64_t p = i + 1; p < n; p++)
+                {
+                    const double u = mat_elem(LU, i, p);
+                    for (int64_t j = c0; j < c0 + width; j++)
+                    {
+                        pmat_elem(b, i, j) -= u * pmat_elem(b, p, j);
+                    }
+                }
+                const double d = mat_elem(LU, i, i);
+                for (int64_t j = c0; j < c0 + width; j++)
+                {
+                    pmat_elem(b, i, j) /= d;
+                }
             }
+            trace_record("lu_solve", start);
+        }
+    }
+}
+
+// chol_dot: 行 a と行 b の先頭 width 要素の内積
+static double chol_dot(const double *a, const double *b, int64_t width)
+{
+    double s = 0.0;
+#pragma omp simd reduction(+ : s)
+    for (int64_t p = 0; p < width; p++)
+    {
+        s += a[p] * b[p];
+    }
+    return s;
+}
+
+// chol_factor: 列k0から幅wの対角タイルをコレスキー分解する．正定値でなければfalse
+static bool chol_factor(matrix *L, int64_t k0, int64_t w)
+{
+    for (int64_t c = k0; c < k0 + w; c++)
+    {
+        const double *lc = &pmat_elem(L, c, k0);
+        double d = pmat_elem(L, c, c) - chol_dot(lc, lc, c - k0);
+        if (!(d > 0.0))
+            return false;
+        d = sqrt(d);
+        pmat_elem(L, c, c) = d;
+        for (int64_t r = c + 1; r < k0 + w; r++)
+        {
+            pmat_elem(L, r, c) = (pmat_elem(L, r, c) - chol_dot(&pmat_elem(L, r, k0), lc, c - k0)) / d;
         }
     }
     return true;
 }
 
-// mat_solve: 連立一次方程式 ax=b を解く．ピボット選択付き
-bool mat_solve(matrix *x, matrix A_, matrix b_)
+// chol_trsm: 行i0から m 行，列k0から幅wのタイルを，分解済みの対角タイルで L_ik = A_ik L_kk^{-T} にする
+static void chol_trsm(matrix *L, int64_t k0, int64_t w, int64_t i0, int64_t m)
 {
-    return false;
+    for (int64_t r = i0; r < i0 + m; r++)
+    {
+        const double *lr = &pmat_elem(L, r, k0);
+        for (int64_t c = k0; c < k0 + w; c++)
+        {
+            pmat_elem(L, r, c) = (pmat_elem(L, r, c) - chol_dot(lr, &pmat_elem(L, c, k0), c - k0)) /
+                                 pmat_elem(L, c, c);
+        }
+    }
 }
 
-// mat_inverse: 行列Aの逆行列を*invAに与える
-bool mat_inverse(matrix *invA, matrix A)
+// chol_update: 行i0から m 行，列j0から n 列のタイルから L_ik L_jk^T (列k0から幅w) を引く
+// 対角タイル (i0 == j0) は下三角部分だけを更新する
+static void chol_update(matrix *L, int64_t k0, int64_t w, int64_t i0, int64_t m, int64_t j0, int64_t n)
 {
-    return false;
+    for (int64_t r = i0; r < i0 + m; r++)
+    {
+        const double *lr = &pmat_elem(L, r, k0);
+        const int64_t c1 = i0 == j0 ? r + 1 : j0 + n;
+        for (int64_t c = j0; c < c1; c++)
+        {
+            pmat_elem(L, r, c) -= chol_dot(lr, &pmat_elem(L, c, k0), w);
+        }
+    }
+}
+
+// chol_tasks: 対称正定値行列*Lの下三角部分をコレスキー分解し，A = L L^T となるLを下三角部分に上書きする
+// 上三角部分は読み書きしない．正定値でなければfalse．
+// parallel が false ならスレッドを起こさず，同じタスクを1スレッドで順に実行する
+static bool chol_tasks(matrix *L, bool parallel)
+{
+    const int64_t n = L->rows;
+    const int64_t t = mat_params()->tile;
+    const int64_t nt = (n + t - 1) / t;
+
+    // タイル (i, j) の依存関係を表すための目印 dep[i * nt + j]
+    char *dep = (char *)malloc(nt * nt);
+    if (dep == NULL)
+        return false;
+    bool ok = true;
+
+#pragma omp parallel if (parallel)
+#pragma omp single
+    for (int64_t k = 0; k < nt; k++)
+    {
+        const int64_t k0 = k * t;
+        const int64_t wk = n - k0 < t ? n - k0 : t;
+#pragma omp task firstprivate(k0, wk) depend(inout : dep[k * nt + k]) shared(ok)
+        {
+            const double start = mat_wtime();
+            if (!chol_factor(L, k0, wk))
+            {
+#pragma omp atomic write
+                ok = false;
+            }
+            trace_record("chol_factor", start);
+        }
+        for (int64_t i = k + 1; i < nt; i++)
+        {
+            const int64_t i0 = i * t;
+            const int64_t wi = n - i0 < t ? n - i0 : t;
+#pragma omp task firstprivate(k0, wk, i0, wi) depend(in : dep[k * nt + k]) depend(inout : dep[i * nt + k])
+            {
+                const double start = mat_wtime();
+                chol_trsm(L, k0, wk, i0, wi);
+                trace_record("chol_trsm", start);
+            }
+        }
+        for (int64_t j = k + 1; j < nt; j++)
+        {
+            const int64_t j0 = j * t;
+            const int64_t wj = n - j0 < t ? n - j0 : t;
+            for (int64_t i = j; i < nt; i++)
+            {
+                const int64_t i0 = i * t;
+                const int64_t wi = n - i0 < t ? n - i0 : t;
+#pragma omp task firstprivate(k0, wk, i0, wi, j0, wj) depend(in : dep[i * nt + k], dep[j * nt + k]) depend(inout : dep[i * nt + j])
+                {
+                    const double start = mat_wtime();
+                    chol_update(L, k0, wk, i0, wi, j0, wj);
+                    trace_record("chol_update", start);
+                }
+            }
+        }
+    }
+
+    free(dep);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// 帯行列用関数群
+// ----------------------------------------------------------------------------
+
+/*
+ * 帯行列用構造体
+ * n: 行数 (= 列数)
+ * kl: 対角より下にある非零の帯の本数
+ * ku: 対角より上にある非零の帯の本数
+ * elems: 帯の要素を入れた一次元配列
+ *
+ * i行目には列 i-kl から i+ku+kl までを順に並べる (1行あたり 2*kl+ku+1 要素)．
+ * 右端のkl要素は，ピボット選択付きLU分解でUの帯幅が広がる分の領域．
+ */
+typedef struct
+{
+    int64_t n;
+    int64_t kl;
+    int64_t ku;
+    double *elems;
+} band_matrix;
+
+// 帯行列の要素を取得するマクロ (i-kl <= j <= i+ku+kl の範囲のみ)
+#define band_elem(b, i, j) (b).elems[(i) * (2 * (b).kl + (b).ku + 1) + (j) - (i) + (b).kl]
+
+// mat_solve で帯行列を自動的に見つけて帯行列用の解法を使うかどうか
+static bool mat_band_detect = false;
+
+// mat_set_band_detect: mat_solve で帯行列を自動的に見つけるかどうかを設定する
+void mat_set_band_detect(bool enable)
+{
+    mat_band_detect = enable;
+}
+
+// band_alloc: 帯行列の要素用のメモリを確保し，0で初期化する
+bool band_alloc(band_matrix *band, int64_t n, int64_t kl, int64_t ku)
+{
+    if (n <= 0 || kl < 0 || ku < 0)
+        return false;
+    // バイト数が size_t に収まらない大きさは確保しない
+    const uint64_t width = 2 * (uint64_t)kl + (uint64_t)ku + 1;
+    if ((uint64_t)n > SIZE_MAX / sizeof(double) / width)
+        return false;
+    band->elems = (double *)calloc((size_t)n * width, sizeof(double));
+    if (band->elems == NULL)
+        return false;
+    band->n = n;
+    band->kl = kl;
+    band->ku = ku;
+    return true;
+}
+
+// band_free: 使い終わった帯行列のメモリを解放する
+void band_free(band_matrix *band)
+{
+    free(band->elems);
+    band->n = 0;
+    band->kl = 0;
+    band->ku = 0;
+    band->elems = NULL;
+}
+
+// mat_bandwidth: 正方行列matの下側・上側の帯幅を*kl, *kuに与える
+bool mat_bandwidth(matrix mat, int64_t *kl, int64_t *ku)
+{
+    if (mat.rows != mat.cols || mat.elems == NULL)
+        return false;
+    int64_t l = 0, u = 0;
+#pragma omp parallel for schedule(static) reduction(max : l, u)
+    for (int64_t i = 0; i < mat.rows; i++)
+    {
+        for (int64_t j = 0; j < i; j++)
+        {
+            if (mat_elem(mat, i, j) != 0.0)
+            {
+                l = i - j > l ? i - j : l;
+                break;
+            }
+        }
+        for (int64_t j = mat.cols - 1; j > i; j--)
+        {
+            if (mat_elem(mat, i, j) != 0.0)
+            {
+                u = j - i > u ? j - i : u;
+                break;
+            }
+        }
+    }
+    *kl = l;
+    *ku = u;
+    return true;
+}
+
+// band_from_mat: 正方行列srcを帯行列*dstに写す．帯の外に非零があればfalse
+bool band_from_mat(band_matrix *dst, matrix src)
+{
+    if (src.rows != src.cols || dst->n != src.rows)
+        return false;
+    const int64_t n = dst->n;
+    for (int64_t i = 0; i < n; i++)
+    {
+        for (int64_t j = 0; j < n; j++)
+        {
+            if (j >= i - dst->kl && j <= i + dst->ku)
+                band_elem(*dst, i, j) = mat_elem(src, i, j);
+            else if (mat_elem(src, i, j) != 0.0)
+                return false;
+        }
+        for (int64_t j = i + dst->ku + 1; j <= i + dst->ku + dst->kl && j < n; j++)
+        {
+            band_elem(*dst, i, j) = 0.0;
+        }
+    }
+    return true;
+}
+
+// band_mul: 帯行列bandと行列matの積を*resに代入する
+bool band_mul(matrix *res, band_matrix band, matrix mat)
+{
+    if (mat.rows != band.n || res->rows != band.n || res->cols != mat.cols)
+        return false;
+
+    // matとメモリが (一部でも) 重なるときだけ一時領域で計算する
+    const bool alias = mat_overlap(*res, mat);
+    matrix tmp = *res;
+    if (alias)
+    {
+        tmp.elems = (double *)malloc(res->rows * res->cols * sizeof(double));
+        if (tmp.elems == NULL)
+            return false;
+    }
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < band.n; i++)
+    {
+        const int64_t j0 = i - band.kl > 0 ? i - band.kl : 0;
+        const int64_t j1 = i + band.ku < band.n - 1 ? i + band.ku : band.n - 1;
+        for (int64_t c = 0; c < mat.cols; c++)
+        {
+            double val = 0.0;
+            for (int64_t j = j0; j <= j1; j++)
+            {
+                val += band_elem(band, i, j) * mat_elem(mat, j, c);
+            }
+            mat_elem(tmp, i, c) = val;
+        }
+    }
+
+    if (alias)
+    {
+        memcpy(res->elems, tmp.elems, res->rows * res->cols * sizeof(double));
+        free(tmp.elems);
+    }
+    return true;
+}
+
+// band_solve_tridiag: 三重対角の連立一次方程式 band x = b をトーマス法で解く
+// ピボット選択をしないので，対角優位な行列などに使う
+bool band_solve_tridiag(matrix *x, band_matrix band, matrix b)
+{
+    const int64_t n = band.n;
+    if (band.kl != 1 || band.ku != 1 || b.rows != n || x->rows != n || x->cols != b.cols)
+        return false;
+    double *c = (double *)malloc(n * sizeof(double));
+    if (c == NULL)
+        return false;
+
+    bool ok = true;
+    for (int64_t k = 0; ok && k < b.cols; k++)
+    {
+        // 前進消去: 上の帯をc, 右辺をxに置き換えていく
+        double d = band_elem(band, 0, 0);
+        ok = d != 0.0;
+        c[0] = n > 1 ? band_elem(band, 0, 1) / d : 0.0;
+        pmat_elem(x, 0, k) = mat_elem(b, 0, k) / d;
+        for (int64_t i = 1; ok && i < n; i++)
+        {
+            const double a = band_elem(band, i, i - 1);
+            d = band_elem(band, i, i) - a * c[i - 1];
+            if (d == 0.0)
+            {
+                ok = false;
+                break;
+            }
+            c[i] = i + 1 < n ? band_elem(band, i, i + 1) / d : 0.0;
+            pmat_elem(x, i, k) = (mat_elem(b, i, k) - a * pmat_elem(x, i - 1, k)) / d;
+        }
+        // 後退代入
+        for (int64_t i = n - 2; ok && i >= 0; i--)
+        {
+            pmat_elem(x, i, k) -= c[i] * pmat_elem(x, i + 1, k);
+        }
+    }
+    free(c);
+    return ok;
+}
+
+// band_solve: 連立一次方程式 band x = b を帯行列のままピボット選択付きLU分解で解く
+// 計算量は O(n kl (kl+ku))
+bool band_solve(matrix *x, band_matrix band, matrix b)
+{
+    const int64_t n = band.n;
+    const int64_t kl = band.kl;
+    const int64_t ku = band.ku;
+    if (b.rows != n || x->rows != n || x->cols != b.cols)
+        return false;
+
+    band_matrix A;
+    if (!band_alloc(&A, n, kl, ku))
+        return false;
+    matrix y;
+    y.rows = n;
+    y.cols = b.cols;
+    y.elems = (double *)malloc(n * b.cols * sizeof(double));
+    if (y.elems == NULL)
+    {
+        band_free(&A);
+        return false;
+    }
+    memcpy(A.elems, band.elems, n * (2 * kl + ku + 1) * sizeof(double));
+    memcpy(y.elems, b.elems, n * b.cols * sizeof(double));
+    int64_t *piv = (int64_t *)malloc(n * sizeof(int64_t));
+
+    double amax = 0.0;
+    for (int64_t i = 0; i < n * (2 * kl + ku + 1); i++)
+    {
+        amax = fmax(amax, fabs(A.elems[i]));
+    }
+    const double tol = n * DBL_EPSILON * amax;
+
+    // LU分解 (Uの帯幅は行交換で kl+ku まで広がる)
+    bool ok = piv != NULL;
+    for (int64_t c = 0; ok && c < n; c++)
+    {
+        const int64_t r1 = c + kl < n - 1 ? c + kl : n - 1;
+        const int64_t j1 = c + kl + ku < n - 1 ? c + kl + ku : n - 1;
+        int64_t p = c;
+        for (int64_t r = c + 1; r <= r1; r++)
+        {
+            if (fabs(band_elem(A, r, c)) > fabs(band_elem(A, p, c)))
+                p = r;
+        }
+        piv[c] = p;
+        if (p != c)
+        {
+            for (int64_t j = c; j <= j1; j++)
+            {
+                swap(band_elem(A, c, j), band_elem(A, p, j));
+            }
+        }
+        const double d = band_elem(A, c, c);
+        if (fabs(d) <= tol)
+        {
+            ok = false;
+            break;
+        }
+        for (int64_t r = c + 1; r <= r1; r++)
+        {
+            const double l = (band_elem(A, r, c) /= d);
+            for (int64_t j = c + 1; j <= j1; j++)
+            {
+                band_elem(A, r, j) -= l * band_elem(A, c, j);
+            }
+        }
+    }
+
+    // 前進代入 (行交換は分解と同じ順に適用する) と後退代入
+    for (int64_t k = 0; ok && k < y.cols; k++)
+    {
+        for (int64_t c = 0; c < n; c++)
+        {
+            const int64_t r1 = c + kl < n - 1 ? c + kl : n - 1;
+            swap(mat_elem(y, c, k), mat_elem(y, piv[c], k));
+            for (int64_t r = c + 1; r <= r1; r++)
+            {
+                mat_elem(y, r, k) -= band_elem(A, r, c) * mat_elem(y, c, k);
+            }
+        }
+        for (int64_t i = n - 1; i >= 0; i--)
+        {
+            const int64_t j1 = i + kl + ku < n - 1 ? i + kl + ku : n - 1;
+            double val = mat_elem(y, i, k);
+            for (int64_t j = i + 1; j <= j1; j++)
+            {
+                val -= band_elem(A, i, j) * mat_elem(y, j, k);
+            }
+            mat_elem(y, i, k) = val / band_elem(A, i, i);
+        }
+    }
+    if (ok)
+        memcpy(x->elems, y.elems, n * y.cols * sizeof(double));
+
+    free(piv);
+    free(y.elems);
+    band_free(&A);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// 行列演算用関数群
+// ----------------------------------------------------------------------------
+
+bool mat_same_size(matrix mat1, matrix mat2)
+{
+    if (mat1.cols != mat2.cols || mat1.rows != mat2.rows)
+        return false;
+    return true;
+}
+// mat_alloc: 行列要素用のメモリを確保する
+bool mat_alloc(matrix *mat, int64_t rows, int64_t cols)
+{
+    return mat_alloc_numa(mat, rows, cols, mat_numa_default);
+}
+
+// mat_free: 使い終わった行列のメモリを解放する
+void mat_free(matrix *mat)
+{
+    free(mat->elems);
+    mat->cols = 0;
+    mat->rows = 0;
+    mat->elems = NULL;
+}
+
+// mat_print: 行列の中身を表示する
+void mat_print(matrix mat)
+{
+    if (mat.rows == 0 || mat.cols == 0 || mat.elems == NULL)
+    {
+        fprintf(stderr, "Matrix is NULL or zero size!\n");
+        return;
+    }
+
+    for (int64_t i = 0; i < mat.rows; i++)
+    {
+        for (int64_t j = 0; j < mat.cols; j++)
+        {
+            printf("%6.4f%s", mat_elem(mat, i, j), (j == mat.cols - 1) ? "\n" : "  ");
+        }
+    }
+}
+
+// mat_copy: srcの中身を*dstにコピーする
+bool mat_copy(matrix *dst, matrix src)
+{
+    if (!mat_same_size(*dst, src))
+        return false;
+    memcpy(dst->elems, src.elems, dst->rows * dst->cols * sizeof(double));
+    return true;
+}
+
+// mat_add: mat1+mat2を*resに代入する
+bool mat_add(matrix *res, matrix mat1, matrix mat2)
+{
+    if (!mat_same_size(*res, mat1) || !mat_same_size(mat1, mat2) || !mat_same_size(mat2, *res))
+        return false;
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < res->rows * res->cols; i++)
+    {
+        res->elems[i] = mat1.elems[i] + mat2.elems[i];
+    }
+    return true;
+}
+
+// mat_sub: mat1-mat2を*resに代入する
+bool mat_sub(matrix *res, matrix mat1, matrix mat2)
+{
+    if (!mat_same_size(*res, mat1) || !mat_same_size(mat1, mat2) || !mat_same_size(mat2, *res))
+        return false;
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < res->rows * res->cols; i++)
+    {
+        res->elems[i] = mat1.elems[i] - mat2.elems[i];
+    }
+    return true;
+}
+
+/*
+ * 行列とベクトルの積 (GEMV) と階数1の更新 (GER)
+ * どちらも行列を1回だけ先頭から順に読む (書く) ので，大きな行列ではメモリの帯域で速さが決まる．
+ * 要素数がこれより少なければ，スレッドを起こす手間の方が大きいので1スレッドで計算する．
+ */
+static const int64_t gemv_par_min = 1 << 15;
+
+// 転置したGEMVで1つのスレッドが受け持つ列数 (yの区間 4KB がL1に収まる幅)
+#define MAT_GEMV_CHUNK 512
+
+// mat_is_vector: vが要素数nの行ベクトルまたは列ベクトルか
+static bool mat_is_vector(matrix v, int64_t n)
+{
+    return (v.rows == 1 || v.cols == 1) && v.rows * v.cols == n;
+}
+
+// gemv_n: y = alpha * A x + beta * y (beta == 0 なら y は読まない)
+// 各行とxの内積を行ごとに並列に計算する
+static void gemv_n(double *y, matrix A, const double *x, double alpha, double beta)
+{
+#pragma omp parallel for schedule(static) if (A.rows * A.cols >= gemv_par_min)
+    for (int64_t i = 0; i < A.rows; i++)
+    {
+        const double *ai = &mat_elem(A, i, 0);
+        double s = 0.0;
+#pragma omp simd reduction(+ : s)
+        for (int64_t j = 0; j < A.cols; j++)
+        {
+            s += ai[j] * x[j];
+        }
+        y[i] = beta == 0.0 ? alpha * s : alpha * s + beta * y[i];
+    }
+}
+
+#ifdef _OPENMP
+// gemv_t_rows: 列が少なく列の区間だけではスレッドが余るときの gemv_t．
+// 行を分けて各スレッドが全部の列の部分和を作り，最後に足し合わせる．
+// 作業領域が確保できなければfalse
+static bool gemv_t_rows(double *y, matrix A, const double *x, double alpha, double beta)
+{
+    const int64_t n = A.cols;
+    double *sum = (double *)calloc(n, sizeof(double));
+    if (sum == NULL)
+        return false;
+    bool ok = true;
+#pragma omp parallel reduction(&& : ok)
+    {
+        double *acc = (double *)calloc(n, sizeof(double));
+        ok = acc != NULL;
+#pragma omp for schedule(static)
+        for (int64_t i = 0; i < A.rows; i++)
+        {
+            const double xi = x[i];
+            const double *ai = &mat_elem(A, i, 0);
+            if (acc == NULL)
+                continue;
+#pragma omp simd
+            for (int64_t j = 0; j < n; j++)
+            {
+                acc[j] += xi * ai[j];
+            }
+        }
+        if (acc != NULL)
+        {
+#pragma omp critical(gemv_t_rows)
+            for (int64_t j = 0; j < n; j++)
+            {
+                sum[j] += acc[j];
+            }
+        }
+        free(acc);
+    }
+    if (ok)
+    {
+        for (int64_t j = 0; j < n; j++)
+        {
+            y[j] = beta == 0.0 ? alpha * sum[j] : alpha * sum[j] + beta * y[j];
+        }
+    }
+    free(sum);
+    return ok;
+}
+#endif
+
+// gemv_t: y = alpha * A^T x + beta * y (beta == 0 なら y は読まない)
+// 列をMAT_GEMV_CHUNK列ずつに分けて各スレッドに割り当て，yの各区間は1つのスレッドだけが書く．
+// 各スレッドは全部の行の自分の区間を順に読み，行ごとに x[i] 倍してyの区間に足す
+static void gemv_t(double *y, matrix A, const double *x, double alpha, double beta)
+{
+    const int64_t n = A.cols;
+    const int64_t nchunk = (n + MAT_GEMV_CHUNK - 1) / MAT_GEMV_CHUNK;
+#ifdef _OPENMP
+    const bool par = A.rows * A.cols >= gemv_par_min;
+    if (par && nchunk < omp_get_max_threads() && gemv_t_rows(y, A, x, alpha, beta))
+        return;
+#endif
+
+#pragma omp parallel for schedule(static) if (par)
+    for (int64_t c = 0; c < nchunk; c++)
+    {
+        const int64_t j0 = c * MAT_GEMV_CHUNK;
+        const int64_t w = n - j0 < MAT_GEMV_CHUNK ? n - j0 : MAT_GEMV_CHUNK;
+        double acc[MAT_GEMV_CHUNK];
+        memset(acc, 0, w * sizeof(double));
+        for (int64_t i = 0; i < A.rows; i++)
+        {
+            const double xi = x[i];
+            const double *ai = &mat_elem(A, i, j0);
+#pragma omp simd
+            for (int64_t j = 0; j < w; j++)
+            {
+                acc[j] += xi * ai[j];
+            }
+        }
+        for (int64_t j = 0; j < w; j++)
+        {
+            y[j0 + j] = beta == 0.0 ? alpha * acc[j] : alpha * acc[j] + beta * y[j0 + j];
+        }
+    }
+}
+
+// ger_rows: A += alpha * x y^T (add が false なら A = alpha * x y^T)
+static void ger_rows(matrix *A, double alpha, const double *x, const double *y, bool add)
+{
+#pragma omp parallel for schedule(static) if (A->rows * A->cols >= gemv_par_min)
+    for (int64_t i = 0; i < A->rows; i++)
+    {
+        double *ai = &pmat_elem(A, i, 0);
+        const double axi = alpha * x[i];
+        if (add)
+        {
+#pragma omp simd
+            for (int64_t j = 0; j < A->cols; j++)
+            {
+                ai[j] += axi * y[j];
+            }
+        }
+        else
+        {
+#pragma omp simd
+            for (int64_t j = 0; j < A->cols; j++)
+            {
+                ai[j] = axi * y[j];
+            }
+        }
+    }
+}
+
+// mat_gemv: *y = alpha * A x + beta * *y (trans なら A の代わりに A^T) を計算する
+// x, y は行ベクトルでも列ベクトルでもよい．beta == 0 なら *y の元の値は使わない
+bool mat_gemv(matrix *y, matrix A, matrix x, bool trans, double alpha, double beta)
+{
+    const int64_t m = trans ? A.cols : A.rows, n = trans ? A.rows : A.cols;
+    if (!mat_is_vector(x, n) || !mat_is_vector(*y, m))
+        return false;
+
+    // yが入力と重なっているときだけ，ベクトル1本分の一時領域に計算する
+    double *out = y->elems;
+    if (mat_overlap(*y, A) || mat_overlap(*y, x))
+    {
+        out = (double *)malloc(m * sizeof(double));
+        if (out == NULL)
+            return false;
+        if (beta != 0.0)
+            memcpy(out, y->elems, m * sizeof(double));
+    }
+
+    if (trans)
+        gemv_t(out, A, x.elems, alpha, beta);
+    else
+        gemv_n(out, A, x.elems, alpha, beta);
+
+    if (out != y->elems)
+    {
+        memcpy(y->elems, out, m * sizeof(double));
+        free(out);
+    }
+    return true;
+}
+
+// mat_ger: *A に alpha * x y^T を加える (x は A の行数，y は列数の要素を持つベクトル)
+bool mat_ger(matrix *A, double alpha, matrix x, matrix y)
+{
+    if (!mat_is_vector(x, A->rows) || !mat_is_vector(y, A->cols))
+        return false;
+
+    // x, y が A と重なっていれば，先に読み出しておく
+    double *buf = NULL;
+    const double *px = x.elems, *py = y.elems;
+    if (mat_overlap(*A, x) || mat_overlap(*A, y))
+    {
+        buf = (double *)malloc((A->rows + A->cols) * sizeof(double));
+        if (buf == NULL)
+            return false;
+        memcpy(buf, x.elems, A->rows * sizeof(double));
+        memcpy(buf + A->rows, y.elems, A->cols * sizeof(double));
+        px = buf;
+        py = buf + A->rows;
+    }
+    ger_rows(A, alpha, px, py, true);
+    free(buf);
+    return true;
+}
+
+// mat_mul: mat1とmat2の行列積を*resに代入する
+bool mat_mul(matrix *res, matrix mat1, matrix mat2)
+{
+    if (mat1.cols != mat2.rows || res->rows != mat1.rows || res->cols != mat2.cols)
+        return false;
+
+    // どちらかがベクトルなら行列とベクトルの積 (または外積) として計算する
+    if (mat2.cols == 1)
+        return mat_gemv(res, mat1, mat2, false, 1.0, 0.0);
+    if (mat1.rows == 1)
+        return mat_gemv(res, mat2, mat1, true, 1.0, 0.0);
+    if (mat1.cols == 1 && !mat_overlap(*res, mat1) && !mat_overlap(*res, mat2))
+    {
+        ger_rows(res, 1.0, mat1.elems, mat2.elems, false);
+        return true;
+    }
+
+    // 入力とメモリが (一部でも) 重なるときだけ一時領域で計算する
+    const bool alias = mat_overlap(*res, mat1) || mat_overlap(*res, mat2);
+    matrix tmp = *res;
+    if (alias && !mat_alloc(&tmp, res->rows, res->cols))
+        return false;
+
+    // 計算量が小さければ，スレッドを起こさずに同じタイル分割で1スレッドで計算する
+    const double work = (double)res->rows * res->cols * mat1.cols;
+    const double task_min = mat_params()->task_min;
+    const bool parallel = work >= task_min * task_min * task_min;
+    if (mat_numa_default == MAT_NUMA_ROWS)
+        gemm_tiles(&tmp, mat1, mat2, parallel);
+    else
+        gemm_tasks(&tmp, mat1, mat2, parallel);
+
+    if (alias)
+    {
+        memcpy(res->elems, tmp.elems, res->rows * res->cols * sizeof(double));
+        mat_free(&tmp);
+    }
+    return true;
+}
+
+// mat_muls: matをc倍（スカラー倍）した結果を*resに代入する
+bool mat_muls(matrix *res, matrix mat, double c)
+{
+    if (!mat_same_size(*res, mat))
+        return false;
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < res->rows * res->cols; i++)
+    {
+        res->elems[i] = mat.elems[i] * c;
+    }
+    return true;
+}
+
+// mat_trans: matの転置行列を*resに代入する
+// 小さなブロックごとに転置して，同時に触るページの数 (TLBミス) を抑える
+bool mat_trans(matrix *res, matrix mat)
+{
+    if (res->cols != mat.rows || res->rows != mat.cols)
+        return false;
+    const int64_t b = mat_params()->trans_tile;
+    // 書き込み先の行で分割する (メモリ配置の行分割と合わせる)
+#pragma omp parallel for schedule(static)
+    for (int64_t j0 = 0; j0 < mat.cols; j0 += b)
+    {
+        const int64_t j1 = j0 + b < mat.cols ? j0 + b : mat.cols;
+        for (int64_t i0 = 0; i0 < mat.rows; i0 += b)
+        {
+            const int64_t i1 = i0 + b < mat.rows ? i0 + b : mat.rows;
+            for (int64_t j = j0; j < j1; j++)
+            {
+                for (int64_t i = i0; i < i1; i++)
+                {
+                    mat_elem(*res, j, i) = mat_elem(mat, i, j);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// mat_unit: 単位行列を与える
+bool mat_ident(matrix *mat)
+{
+    if (mat->cols != mat->rows)
+        return false;
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < mat->rows; i++)
+    {
+        for (int64_t j = 0; j < mat->cols; j++)
+        {
+            if (i == j)
+            {
+                mat_elem(*mat, i, j) = 1;
+            }
+            else
+            {
+                mat_elem(*mat, i, j) = 0;
+            }
+        }
+    }
+    return true;
+}
+
+// mat_equal: mat1とmat2が等しければtrueを返す
+bool mat_equal(matrix mat1, matrix mat2)
+{
+    if (!mat_same_size(mat1, mat2))
+        return false;
+    for (int64_t i = 0; i < mat1.rows; i++)
+    {
+        for (int64_t j = 0; j < mat1.cols; j++)
+        {
+            if (mat_elem(mat1, i, j) != mat_elem(mat2, i, j))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// mat_solve: 連立一次方程式 ax=b を解く．ピボット選択付き
+// bは複数列でもよい (列ごとの連立方程式をまとめて解く)
+bool mat_solve(matrix *x, matrix A_, matrix b_)
+{
+    const int64_t n = A_.rows;
+    if (A_.cols != n || b_.rows != n || x->rows != n || x->cols != b_.cols)
+        return false;
+
+    // 帯幅が十分狭ければ帯行列として解く
+    int64_t kl, ku;
+    if (mat_band_detect && mat_bandwidth(A_, &kl, &ku) && 4 * (2 * kl + ku + 1) < n)
+    {
+        band_matrix band;
+        if (band_alloc(&band, n, kl, ku))
+        {
+            const bool ok = band_from_mat(&band, A_) && band_solve(x, band, b_);
+            band_free(&band);
+            return ok;
+        }
+    }
+
+    // 入力を壊さないよう (また x と同じ行列でもよいよう) 作業用にコピーする
+    matrix A, b;
+    if (!mat_alloc(&A, n, n))
+        return false;
+    if (!mat_alloc(&b, n, b_.cols))
+    {
+        mat_free(&A);
+        return false;
+    }
+    memcpy(A.elems, A_.elems, n * n * sizeof(double));
+    memcpy(b.elems, b_.elems, n * b_.cols * sizeof(double));
+    int64_t *piv = (int64_t *)malloc(n * sizeof(int64_t));
+
+    const bool ok = piv != NULL && lu_tasks(&A, piv);
+    if (ok)
+    {
+        lu_solve_tasks(A, piv, &b);
+        memcpy(x->elems, b.elems, n * b.cols * sizeof(double));
+    }
+
+    free(piv);
+    mat_free(&A);
+    mat_free(&b);
+    return ok;
+}
+
+// mat_inverse: 行列Aの逆行列を*invAに与える
+bool mat_inverse(matrix *invA, matrix A)
+{
+    if (A.rows != A.cols || !mat_same_size(*invA, A))
+        return false;
+    matrix I;
+    if (!mat_alloc(&I, A.rows, A.cols))
+        return false;
+    mat_ident(&I);
+    const bool ok = mat_solve(invA, A, I);
+    mat_free(&I);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// 乱数行列の生成
+// ----------------------------------------------------------------------------
+
+/*
+ * 乱数行列の種類
+ * MAT_RAND_UNIFORM: [0, 1) の一様乱数
+ * MAT_RAND_NORMAL: 平均0, 分散1の正規乱数
+ * MAT_RAND_SPD: 対称正定値行列 (正方行列のみ)
+ * MAT_RAND_DIAG_DOMINANT: 狭義対角優位行列 (正方行列のみ)
+ */
+typedef enum
+{
+    MAT_RAND_UNIFORM,
+    MAT_RAND_NORMAL,
+    MAT_RAND_SPD,
+    MAT_RAND_DIAG_DOMINANT,
+} mat_rand_kind;
+
+// philox4x32_10: カウンタベースの乱数生成器 (Philox4x32-10)
+// 同じ (カウンタ, 鍵) からは常に同じ乱数が得られるので，要素ごとに独立に計算できる
+static inline void philox4x32_10(uint32_t ctr[4], uint64_t seed)
+{
+    uint32_t k0 = (uint32_t)seed;
+    uint32_t k1 = (uint32_t)(seed >> 32);
+    for (int r = 0; r < 10; r++)
+    {
+        const uint64_t p0 = (uint64_t)0xD2511F53u * ctr[0];
+        const uint64_t p1 = (uint64_t)0xCD9E8D57u * ctr[2];
+        const uint32_t c0 = (uint32_t)(p1 >> 32) ^ ctr[1] ^ k0;
+        const uint32_t c2 = (uint32_t)(p0 >> 32) ^ ctr[3] ^ k1;
+        ctr[0] = c0;
+        ctr[1] = (uint32_t)p1;
+        ctr[2] = c2;
+        ctr[3] = (uint32_t)p0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+}
+
+// philox_uniform2: カウンタ番号ctrに対応する [0, 1) の一様乱数を2つ得る
+static inline void philox_uniform2(uint64_t seed, uint64_t ctr, double *u0, double *u1)
+{
+    uint32_t c[4] = {(uint32_t)ctr, (uint32_t)(ctr >> 32), 0, 0};
+    philox4x32_10(c, seed);
+    // 32bit乱数2つから53bitの仮数を作る
+    *u0 = ((c[0] >> 5) * 67108864.0 + (c[1] >> 6)) * (1.0 / 9007199254740992.0);
+    *u1 = ((c[2] >> 5) * 67108864.0 + (c[3] >> 6)) * (1.0 / 9007199254740992.0);
+}
+
+// philox_uniform_at: 一次元添字idxの要素に割り当てられる一様乱数
+static inline double philox_uniform_at(uint64_t seed, uint64_t idx)
+{
+    double u0, u1;
+    philox_uniform2(seed, idx >> 1, &u0, &u1);
+    return (idx & 1) ? u1 : u0;
+}
+
+// philox_normal2: カウンタ番号ctrに対応する正規乱数を2つ得る (Box-Muller法)
+static inline void philox_normal2(uint64_t seed, uint64_t ctr, double *z0, double *z1)
+{
+    double u0, u1;
+    philox_uniform2(seed, ctr, &u0, &u1);
+    const double r = sqrt(-2.0 * log(1.0 - u0));
+    const double t = 2.0 * M_PI * u1;
+    *z0 = r * cos(t);
+    *z1 = r * sin(t);
+}
+
+// mat_fill_random: 乱数で*matを埋める
+// 要素ごとにカウンタを割り当てるため，結果はseedのみで決まりスレッド数に依存しない
+bool mat_fill_random(matrix *mat, mat_rand_kind kind, uint64_t seed)
+{
+    if (mat->rows <= 0 || mat->cols <= 0 || mat->elems == NULL)
+        return false;
+    if ((kind == MAT_RAND_SPD || kind == MAT_RAND_DIAG_DOMINANT) && mat->rows != mat->cols)
+        return false;
+
+    const int64_t n = mat->rows * mat->cols;
+    const int64_t half = n / 2;
+    double *e = mat->elems;
+
+    switch (kind)
+    {
+    case MAT_RAND_UNIFORM:
+#pragma omp parallel for simd schedule(static)
+        for (int64_t k = 0; k < half; k++)
+        {
+            philox_uniform2(seed, (uint64_t)k, &e[2 * k], &e[2 * k + 1]);
+        }
+        if (n % 2 != 0)
+            e[n - 1] = philox_uniform_at(seed, (uint64_t)(n - 1));
+        break;
+
+    case MAT_RAND_NORMAL:
+#pragma omp parallel for simd schedule(static)
+        for (int64_t k = 0; k < half; k++)
+        {
+            philox_normal2(seed, (uint64_t)k, &e[2 * k], &e[2 * k + 1]);
+        }
+        if (n % 2 != 0)
+        {
+            double z0, z1;
+            philox_normal2(seed, (uint64_t)half, &z0, &z1);
+            e[n - 1] = z0;
+        }
+        break;
+
+    case MAT_RAND_SPD:
+    {
+        // 上三角の乱数を下三角にも使って対称にし，対角を大きくとって正定値にする
+        // (非対角要素の絶対値和 < n-1 < 対角要素 なので狭義対角優位 → 正定値)
+        const int64_t size = mat->rows;
+#pragma omp parallel for schedule(static)
+        for (int64_t i = 0; i < size; i++)
+        {
+            for (int64_t j = 0; j < size; j++)
+            {
+                const int64_t lo = i < j ? i : j;
+                const int64_t hi = i < j ? j : i;
+                const double u = philox_uniform_at(seed, (uint64_t)(lo * size + hi));
+                mat_elem(*mat, i, j) = (i == j) ? size + u : u;
+            }
+        }
+        break;
+    }
+
+    case MAT_RAND_DIAG_DOMINANT:
+    {
+        // 一様乱数の対角要素を，同じ行の非対角要素の絶対値和+1で置き換える
+        const int64_t size = mat->rows;
+#pragma omp parallel for schedule(static)
+        for (int64_t i = 0; i < size; i++)
+        {
+            double sum = 0.0;
+            for (int64_t j = 0; j < size; j++)
+            {
+                const double u = philox_uniform_at(seed, (uint64_t)(i * size + j));
+                mat_elem(*mat, i, j) = u;
+                if (i != j)
+                    sum += fabs(u);
+            }
+            mat_elem(*mat, i, i) = sum + 1.0 + mat_elem(*mat, i, i);
+        }
+        break;
+    }
+
+    default:
+        return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// ディスク上の行列 (out-of-core) 用関数群
+// ----------------------------------------------------------------------------
+
+/*
+ * ディスク上の行列用構造体
+ * rows: 行数
+ * cols: 列数
+ * tile: タイルの一辺の長さ
+ * tile_rows: 縦方向のタイル数
+ * tile_cols: 横方向のタイル数
+ * fp: タイルを格納するファイル
+ *
+ * 行列は tile x tile のタイルに分割され，タイルごとに連続した領域に格納される．
+ * 端のタイルは0で埋めて tile x tile の大きさにそろえる．
+ */
+typedef struct
+{
+    int64_t rows;
+    int64_t cols;
+    int64_t tile;
+    int64_t tile_rows;
+    int64_t tile_cols;
+    FILE *fp;
+} ooc_matrix;
+
+// ooc_tile_for_budget: メモリ使用量がbytes以内になるタイルの一辺の長さを返す
+// ntiles: 同時にメモリ上に置くタイルの数
+int64_t ooc_tile_for_budget(int64_t bytes, int ntiles)
+{
+    int64_t t = (int64_t)sqrt((double)bytes / (ntiles * (double)sizeof(double)));
+    t -= t % 8;
+    return t < 8 ? 8 : t;
+}
+
+// ooc_lu_tile_for_budget: n x n の行列を ooc_lu で分解するときに，
+// メモリ使用量 (タイル列1本 ceil(n/t)*t*t とタイル1枚 t*t) がbytes以内になるタイルの一辺の長さを返す
+int64_t ooc_lu_tile_for_budget(int64_t bytes, int64_t n)
+{
+    // ceil(n/t) の切り上げのため使用量はtについて単調ではないので，
+    // タイル2枚分 (2t^2) が収まる大きさから8ずつ小さくして，収まる最大のものを探す
+    const double words = (double)bytes / sizeof(double);
+    int64_t t = (int64_t)sqrt(words / 2.0);
+    if (t > n + 8)
+        t = n + 8;
+    t -= t % 8;
+    while (t > 8 && (double)((n + t - 1) / t + 1) * t * t > words)
+    {
+        t -= 8;
+    }
+    return t < 8 ? 8 : t;
+}
+
+// ooc_init: 開いたファイルfpを使う行列として*matを設定する
+static void ooc_init(ooc_matrix *mat, FILE *fp, int64_t rows, int64_t cols, int64_t tile)
+{
+    mat->fp = fp;
+    mat->rows = rows;
+    mat->cols = cols;
+    mat->tile = tile;
+    mat->tile_rows = (rows + tile - 1) / tile;
+    mat->tile_cols = (cols + tile - 1) / tile;
+}
+
+// ooc_file_size: タイルに分けて格納したときのファイルの大きさ
+static off_t ooc_file_size(const ooc_matrix *mat)
+{
+    return (off_t)mat->tile_rows * mat->tile_cols * mat->tile * mat->tile * sizeof(double);
+}
+
+// ooc_alloc: pathのファイルに行列を確保する (既にあれば中身を捨てる)．pathがNULLなら一時ファイルを使う
+bool ooc_alloc(ooc_matrix *mat, const char *path, int64_t rows, int64_t cols, int64_t tile)
+{
+    if (rows <= 0 || cols <= 0 || tile <= 0)
+        return false;
+    FILE *fp = path != NULL ? fopen(path, "w+b") : tmpfile();
+    if (fp == NULL)
+        return false;
+    ooc_init(mat, fp, rows, cols, tile);
+
+    // ファイルを必要な大きさに伸ばす (中身は0になる)
+    if (ftruncate(fileno(mat->fp), ooc_file_size(mat)) != 0)
+    {
+        fclose(mat->fp);
+        mat->fp = NULL;
+        return false;
+    }
+    return true;
+}
+
+// ooc_open: ooc_alloc で作ったpathのファイルを，中身を残したまま開き直す
+// rows, cols, tile は作ったときと同じ値を渡す．ファイルの大きさが合わなければfalse
+bool ooc_open(ooc_matrix *mat, const char *path, int64_t rows, int64_t cols, int64_t tile)
+{
+    if (rows <= 0 || cols <= 0 || tile <= 0 || path == NULL)
+        return false;
+    FILE *fp = fopen(path, "r+b");
+    if (fp == NULL)
+        return false;
+    ooc_init(mat, fp, rows, cols, tile);
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size != ooc_file_size(mat))
+    {
+        fclose(fp);
+        mat->fp = NULL;
+        return false;
+    }
+    return true;
+}
+
+// ooc_free: ファイルを閉じる
+void ooc_free(ooc_matrix *mat)
+{
+    if (mat->fp != NULL)
+        fclose(mat->fp);
+    mat->fp = NULL;
+    mat->rows = 0;
+    mat->cols = 0;
+    mat->tile_rows = 0;
+    mat->tile_cols = 0;
+}
+
+// ooc_tile_offset: タイル(ti, tj)のファイル上の位置
+static off_t ooc_tile_offset(const ooc_matrix *mat, int64_t ti, int64_t tj)
+{
+    return ((off_t)ti * mat->tile_cols + tj) * mat->tile * mat->tile * sizeof(double);
+}
+
+// ooc_read_tile: タイル(ti, tj)をbufに読み込む
+static bool ooc_read_tile(const ooc_matrix *mat, int64_t ti, int64_t tj, double *buf)
+{
+    const size_t size = (size_t)mat->tile * mat->tile * sizeof(double);
+    const off_t offset = ooc_tile_offset(mat, ti, tj);
+    for (size_t done = 0; done < size;)
+    {
+        const ssize_t r = pread(fileno(mat->fp), (char *)buf + done, size - done, offset + done);
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+// ooc_write_tile: bufの内容をタイル(ti, tj)に書き込む
+static bool ooc_write_tile(const ooc_matrix *mat, int64_t ti, int64_t tj, const double *buf)
+{
+    const size_t size = (size_t)mat->tile * mat->tile * sizeof(double);
+    const off_t offset = ooc_tile_offset(mat, ti, tj);
+    for (size_t done = 0; done < size;)
+    {
+        const ssize_t r = pwrite(fileno(mat->fp), (const char *)buf + done, size - done, offset + done);
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+// ooc_prefetch_tile: 次に使うタイルの読み込みをOSに非同期で始めさせる
+// 計算中に読み込みが進むので，ooc_read_tileの待ち時間が隠れる
+static void ooc_prefetch_tile(const ooc_matrix *mat, int64_t ti, int64_t tj)
+{
+    if (ti < 0 || tj < 0 || ti >= mat->tile_rows || tj >= mat->tile_cols)
+        return;
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fileno(mat->fp), ooc_tile_offset(mat, ti, tj),
+                  (off_t)mat->tile * mat->tile * sizeof(double), POSIX_FADV_WILLNEED);
+#endif
+}
+
+// ooc_store_rows: メモリ上の行列srcを*dstの r0 行目から src.rows 行分に書き込む
+// 行列全体をメモリに置かずに，行のまとまりごとに順に書き込める．
+// タイルの一部だけを書き換えるときは，そのタイルを読んでから書き戻す
+bool ooc_store_rows(ooc_matrix *dst, int64_t r0, matrix src)
+{
+    if (dst->cols != src.cols || r0 < 0 || r0 + src.rows > dst->rows || dst->fp == NULL)
+        return false;
+    const int64_t t = dst->tile;
+    const int64_t r1 = r0 + src.rows;
+    double *buf = (double *)calloc((size_t)t * t, sizeof(double));
+    if (buf == NULL)
+        return false;
+    bool ok = true;
+    for (int64_t ti = r0 / t; ok && ti * t < r1; ti++)
+    {
+        // このタイル行のうち書き込む行の範囲 [i0, i1) (タイル内の番号)
+        const int64_t i0 = r0 > ti * t ? r0 - ti * t : 0;
+        const int64_t i1 = r1 < (ti + 1) * t ? r1 - ti * t : t;
+        const bool whole = i0 == 0 && (i1 == t || ti * t + i1 == dst->rows);
+        for (int64_t tj = 0; ok && tj < dst->tile_cols; tj++)
+        {
+            if (whole)
+                memset(buf, 0, (size_t)t * t * sizeof(double));
+            else if (!(ok = ooc_read_tile(dst, ti, tj, buf)))
+                break;
+            for (int64_t i = i0; i < i1; i++)
+            {
+                for (int64_t j = 0; j < t && tj * t + j < src.cols; j++)
+                {
+                    buf[i * t + j] = mat_elem(src, ti * t + i - r0, tj * t + j);
+                }
+            }
+            ok = ooc_write_tile(dst, ti, tj, buf);
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+// ooc_load_rows: srcの r0 行目から dst->rows 行分をメモリ上の行列*dstに読み込む
+bool ooc_load_rows(matrix *dst, ooc_matrix src, int64_t r0)
+{
+    if (dst->cols != src.cols || r0 < 0 || r0 + dst->rows > src.rows || src.fp == NULL)
+        return false;
+    const int64_t t = src.tile;
+    const int64_t r1 = r0 + dst->rows;
+    double *buf = (double *)malloc((size_t)t * t * sizeof(double));
+    if (buf == NULL)
+        return false;
+    bool ok = true;
+    for (int64_t ti = r0 / t; ok && ti * t < r1; ti++)
+    {
+        const int64_t i0 = r0 > ti * t ? r0 - ti * t : 0;
+        const int64_t i1 = r1 < (ti + 1) * t ? r1 - ti * t : t;
+        for (int64_t tj = 0; ok && tj < src.tile_cols; tj++)
+        {
+            ooc_prefetch_tile(&src, ti, tj + 1);
+            if (!(ok = ooc_read_tile(&src, ti, tj, buf)))
+                break;
+            for (int64_t i = i0; i < i1; i++)
+            {
+                for (int64_t j = 0; j < t && tj * t + j < dst->cols; j++)
+                {
+                    pmat_elem(dst, ti * t + i - r0, tj * t + j) = buf[i * t + j];
+                }
+            }
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+// ooc_store: メモリ上の行列srcの中身を*dstに書き込む
+bool ooc_store(ooc_matrix *dst, matrix src)
+{
+    return dst->rows == src.rows && ooc_store_rows(dst, 0, src);
+}
+
+// ooc_load: *srcの中身をメモリ上の行列*dstに読み込む
+bool ooc_load(matrix *dst, ooc_matrix src)
+{
+    return dst->rows == src.rows && ooc_load_rows(dst, src, 0);
+}
+
+// ooc_mul: mat1とmat2の行列積を*resに書き込む
+// メモリ上にはタイル3枚分しか置かないので，RAMに入らない行列も計算できる
+bool ooc_mul(ooc_matrix *res, ooc_matrix mat1, ooc_matrix mat2)
+{
+    if (mat1.cols != mat2.rows || res->rows != mat1.rows || res->cols != mat2.cols)
+        return false;
+    if (mat1.tile != mat2.tile || res->tile != mat1.tile)
+        return false;
+    if (res->fp == mat1.fp || res->fp == mat2.fp)
+        return false;
+
+    const int64_t t = res->tile;
+    const size_t tsize = (size_t)t * t;
+    double *buf = (double *)malloc(3 * tsize * sizeof(double));
+    if (buf == NULL)
+        return false;
+    double *a = buf;
+    double *b = buf + tsize;
+    double *c = buf + 2 * tsize;
+
+    bool ok = true;
+    for (int64_t ti = 0; ok && ti < res->tile_rows; ti++)
+    {
+        for (int64_t tj = 0; ok && tj < res->tile_cols; tj++)
+        {
+            memset(c, 0, tsize * sizeof(double));
+            for (int64_t tk = 0; tk < mat1.tile_cols; tk++)
+            {
+                // 次のタイルの読み込みを計算と重ねる
+                if (tk + 1 < mat1.tile_cols)
+                {
+                    ooc_prefetch_tile(&mat1, ti, tk + 1);
+                    ooc_prefetch_tile(&mat2, tk + 1, tj);
+                }
+                else
+                {
+                    ooc_prefetch_tile(&mat1, ti + (tj + 1) / res->tile_cols, 0);
+                    ooc_prefetch_tile(&mat2, 0, (tj + 1) % res->tile_cols);
+                }
+                if (!(ok = ooc_read_tile(&mat1, ti, tk, a) && ooc_read_tile(&mat2, tk, tj, b)))
+                    break;
+#pragma omp parallel for schedule(static)
+                for (int64_t i = 0; i < t; i += 8)
+                {
+                    gemm_block(c + (size_t)i * t, a + (size_t)i * t, b, (t - i < 8 ? t - i : 8), t, t, t, t, t, 1.0);
+                }
+            }
+            ok = ok && ooc_write_tile(res, ti, tj, c);
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+// ooc_swap_rows: 行の長さがldの配列の，r1行目とr2行目を交換する
+static void ooc_swap_rows(double *buf, int64_t ld, int64_t r1, int64_t r2)
+{
+    if (r1 == r2)
+        return;
+    for (int64_t j = 0; j < ld; j++)
+    {
+        swap(buf[r1 * ld + j], buf[r2 * ld + j]);
+    }
+}
+
+// ooc_lu: *matをピボット選択付きでLU分解し，LとUを*matに上書きする
+// piv[i]: i行目と交換した行の番号 (LAPACKのipivと同じ形式．長さはrows)
+// 左から順にタイル列を1本ずつメモリに読み込んで分解する (left-looking)．
+// メモリ上に置くのはタイル列1本 (rows x tile) とタイル1枚だけ．
+// 分解済みのタイル列 (L) には後のパネルの行交換をすぐには適用せず，
+// 読み込んだタイル列の方にパネルごとの行交換を更新と交互に適用して順序を合わせる．
+// Lの行交換は最後にタイル列ごとに1回だけまとめて行う (LAPACKのgetrfと同じ)．
+bool ooc_lu(ooc_matrix *mat, int64_t *piv)
+{
+    if (mat->rows != mat->cols || mat->fp == NULL)
+        return false;
+
+    const int64_t n = mat->rows;
+    const int64_t t = mat->tile;
+    const int64_t nt = mat->tile_rows;
+    const size_t tsize = (size_t)t * t;
+    double *panel = (double *)malloc((size_t)nt * tsize * sizeof(double));
+    double *tile = (double *)malloc(tsize * sizeof(double));
+    bool ok = panel != NULL && tile != NULL;
+
+    // 特異とみなす閾値は lu_tasks と同じ n*eps*max|A| (先に全タイルを1回読んで求める)
+    double amax = 0.0;
+    for (int64_t k = 0; ok && k < nt * nt; k++)
+    {
+        ooc_prefetch_tile(mat, (k + 1) / nt, (k + 1) % nt);
+        ok = ooc_read_tile(mat, k / nt, k % nt, tile);
+        for (size_t e = 0; ok && e < tsize; e++)
+        {
+            amax = fmax(amax, fabs(tile[e]));
+        }
+    }
+    const double tol = n * DBL_EPSILON * amax;
+
+    for (int64_t tj = 0; ok && tj < nt; tj++)
+    {
+        const int64_t col0 = tj * t;
+        const int64_t width = (n - col0 < t) ? n - col0 : t;
+
+        // タイル列tjを読み込む
+        for (int64_t ti = 0; ok && ti < nt; ti++)
+        {
+            ooc_prefetch_tile(mat, ti + 1, tj);
+            ok = ooc_read_tile(mat, ti, tj, panel + ti * tsize);
+        }
+        if (!ok)
+            break;
+
+        // 左側のタイル列で更新する
+        for (int64_t tk = 0; ok && tk < tj; tk++)
+        {
+            double *pk = panel + tk * tsize;
+
+            // タイル列tkの分解での行交換を適用する．
+            // ディスク上のタイル列tkのLは，ここまでの行交換だけを適用した行の順序になっている
+            for (int64_t r = tk * t; r < (tk + 1) * t; r++)
+            {
+                ooc_swap_rows(panel, t, r, piv[r]);
+            }
+
+            // 対角タイルのL (単位下三角) で前進代入
+            ooc_prefetch_tile(mat, tk + 1, tk);
+            if (!(ok = ooc_read_tile(mat, tk, tk, tile)))
+                break;
+            for (int64_t i = 1; i < t; i++)
+            {
+                for (int64_t p = 0; p < i; p++)
+                {
+                    const double l = tile[i * t + p];
+                    for (int64_t j = 0; j < t; j++)
+                    {
+                        pk[i * t + j] -= l * pk[p * t + j];
+                    }
+                }
+            }
+
+            // その下のタイルを更新する
+            for (int64_t ti = tk + 1; ti < nt; ti++)
+            {
+                ooc_prefetch_tile(mat, ti + 1, tk);
+                if (!(ok = ooc_read_tile(mat, ti, tk, tile)))
+                    break;
+                double *pi = panel + ti * tsize;
+#pragma omp parallel for schedule(static)
+                for (int64_t i = 0; i < t; i += 8)
+                {
+                    gemm_block(pi + (size_t)i * t, tile + (size_t)i * t, pk, (t - i < 8 ? t - i : 8), t, t, t, t, t, -1.0);
+                }
+            }
+        }
+        if (!ok)
+            break;
+
+        // タイル列の対角から下をピボット選択付きで分解する
+        for (int64_t c = 0; c < width; c++)
+        {
+            const int64_t col = col0 + c;
+            int64_t p = col;
+            for (int64_t r = col + 1; r < n; r++)
+            {
+                if (fabs(panel[r * t + c]) > fabs(panel[p * t + c]))
+                    p = r;
+            }
+            piv[col] = p;
+            ooc_swap_rows(panel, t, col, p);
+
+            const double d = panel[col * t + c];
+            if (!(fabs(d) > tol))
+            {
+                ok = false;
+                break;
+            }
+            for (int64_t r = col + 1; r < n; r++)
+            {
+                const double l = (panel[r * t + c] /= d);
+                for (int64_t j = c + 1; j < width; j++)
+                {
+                    panel[r * t + j] -= l * panel[col * t + j];
+                }
+            }
+        }
+        if (!ok)
+            break;
+
+        for (int64_t ti = 0; ok && ti < nt; ti++)
+        {
+            ok = ooc_write_tile(mat, ti, tj, panel + ti * tsize);
+        }
+    }
+
+    // 後のパネルの行交換を左側のLにまとめて適用する (タイル列ごとに対角より下を1回ずつ読み書きする)
+    for (int64_t tk = 0; ok && tk + 1 < nt; tk++)
+    {
+        for (int64_t ti = tk + 1; ok && ti < nt; ti++)
+        {
+            ooc_prefetch_tile(mat, ti + 1, tk);
+            ok = ooc_read_tile(mat, ti, tk, panel + ti * tsize);
+        }
+        for (int64_t r = (tk + 1) * t; ok && r < n; r++)
+        {
+            ooc_swap_rows(panel, t, r, piv[r]);
+        }
+        for (int64_t ti = tk + 1; ok && ti < nt; ti++)
+        {
+            ok = ooc_write_tile(mat, ti, tk, panel + ti * tsize);
+        }
+    }
+
+    free(panel);
+    free(tile);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// 最小二乗法 (ハウスホルダーQR分解)
+// ----------------------------------------------------------------------------
+
+// qr_wy_apply: C (m x nc, 行の長さldc) に (I - V T V^T)^T = I - V T^T V^T を掛ける
+// V (m x jb) は単位下台形の鏡映ベクトル，Vt はその転置，T (jb x jb) は上三角
+// 列ブロックごとに独立なので並列に計算できる．主な計算は gemm_block で行う
+// 作業領域が確保できなければfalse (そのときCの一部の列ブロックは更新されていない)
+static bool qr_wy_apply(double *C, int64_t m, int64_t nc, int64_t ldc,
+                        const double *V, const double *Vt, const double *T, int64_t jb)
+{
+    const int64_t nb = 64;
+    bool ok = true;
+#pragma omp parallel for schedule(static) reduction(&& : ok)
+    for (int64_t c0 = 0; c0 < nc; c0 += nb)
+    {
+        const int64_t w = nc - c0 < nb ? nc - c0 : nb;
+        double *W = (double *)calloc(2 * jb * w, sizeof(double));
+        if (W == NULL)
+        {
+            ok = false;
+            continue;
+        }
+        double *W2 = W + jb * w;
+
+        // W = V^T C
+        gemm_block(W, Vt, C + c0, jb, w, m, m, ldc, w, 1.0);
+        // W2 = T^T W
+        for (int64_t i = 0; i < jb; i++)
+        {
+            for (int64_t p = 0; p <= i; p++)
+            {
+                const double tpi = T[p * jb + i];
+                for (int64_t j = 0; j < w; j++)
+                {
+                    W2[i * w + j] += tpi * W[p * w + j];
+                }
+            }
+        }
+        // C -= V W2
+        gemm_block(C + c0, V, W2, m, w, jb, jb, w, ldc, -1.0);
+        free(W);
+    }
+    return ok;
+}
+
+// qr_apply: *AをハウスホルダーQR分解し (Rを上三角に上書き)，同時に*BにQ^Tを掛ける
+// qr_tile 列ずつ鏡映をまとめ (compact WY表現 I - V T V^T)，残りの列とBを行列積で更新する
+static bool qr_apply(matrix *A, matrix *B)
+{
+    const int64_t m = A->rows;
+    const int64_t n = A->cols;
+    const int64_t nb = mat_params()->qr_tile;
+    double *V = (double *)malloc(m * nb * sizeof(double));
+    double *Vt = (double *)malloc(m * nb * sizeof(double));
+    double *T = (double *)malloc(nb * nb * sizeof(double));
+    double *tau = (double *)malloc(nb * sizeof(double));
+    bool ok = V != NULL && Vt != NULL && T != NULL && tau != NULL;
+
+    for (int64_t j0 = 0; ok && j0 < n; j0 += nb)
+    {
+        const int64_t jb = n - j0 < nb ? n - j0 : nb;
+        const int64_t mm = m - j0;
+
+        // パネル内を1列ずつ分解する
+        for (int64_t j = j0; j < j0 + jb; j++)
+        {
+            const double alpha = pmat_elem(A, j, j);
+            double sigma = 0.0;
+            for (int64_t i = j + 1; i < m; i++)
+            {
+                sigma += pmat_elem(A, i, j) * pmat_elem(A, i, j);
+            }
+            if (sigma == 0.0)
+            {
+                tau[j - j0] = 0.0;
+                continue;
+            }
+            const double norm = sqrt(alpha * alpha + sigma);
+            const double beta = alpha <= 0.0 ? norm : -norm;
+            const double t = (beta - alpha) / beta;
+            tau[j - j0] = t;
+            for (int64_t i = j + 1; i < m; i++)
+            {
+                pmat_elem(A, i, j) /= alpha - beta;
+            }
+            pmat_elem(A, j, j) = beta;
+
+            // パネルの残りの列に鏡映を掛ける
+            for (int64_t c = j + 1; c < j0 + jb; c++)
+            {
+                double w = pmat_elem(A, j, c);
+                for (int64_t i = j + 1; i < m; i++)
+                {
+                    w += pmat_elem(A, i, j) * pmat_elem(A, i, c);
+                }
+                w *= t;
+                pmat_elem(A, j, c) -= w;
+                for (int64_t i = j + 1; i < m; i++)
+                {
+                    pmat_elem(A, i, c) -= w * pmat_elem(A, i, j);
+                }
+            }
+        }
+
+        // 鏡映ベクトルを V, V^T に取り出す
+        for (int64_t i = 0; i < mm; i++)
+        {
+            for (int64_t p = 0; p < jb; p++)
+            {
+                const double v = i == p ? 1.0 : (i > p ? pmat_elem(A, j0 + i, j0 + p) : 0.0);
+                V[i * jb + p] = v;
+                Vt[p * mm + i] = v;
+            }
+        }
+
+        // T を作る: T[0:i, i] = -tau_i T[0:i, 0:i] V[:, 0:i]^T v_i
+        memset(T, 0, jb * jb * sizeof(double));
+        for (int64_t i = 0; i < jb; i++)
+        {
+            T[i * jb + i] = tau[i];
+            for (int64_t p = 0; p < i; p++)
+            {
+                double z = 0.0;
+                for (int64_t r = i; r < mm; r++)
+                {
+                    z += Vt[p * mm + r] * Vt[i * mm + r];
+                }
+                // 上三角のT[0:i,0:i]を掛けるので，p行目にはp列目以降だけが効く
+                for (int64_t q = 0; q <= p; q++)
+                {
+                    T[q * jb + i] += T[q * jb + p] * z;
+                }
+            }
+            for (int64_t q = 0; q < i; q++)
+            {
+                T[q * jb + i] *= -tau[i];
+            }
+        }
+
+        // 残りの列と右辺を更新する
+        if (j0 + jb < n)
+            ok = qr_wy_apply(&pmat_elem(A, j0, j0 + jb), mm, n - j0 - jb, A->cols, V, Vt, T, jb);
+        if (ok && B != NULL && B->cols > 0)
+            ok = qr_wy_apply(&pmat_elem(B, j0, 0), mm, B->cols, B->cols, V, Vt, T, jb);
+    }
+
+    free(V);
+    free(Vt);
+    free(T);
+    free(tau);
+    return ok;
+}
+
+// qr_back_solve: QR分解したR (A の上三角部分) と Q^T b から R x = (Q^T b)[0:n] を解く
+// Rの対角に (ほぼ) 0 があれば階数落ちとみなしてfalseを返す
+static bool qr_back_solve(matrix *x, matrix R, matrix Qtb)
+{
+    const int64_t n = R.cols;
+    double rmax = 0.0;
+    for (int64_t i = 0; i < n; i++)
+    {
+        rmax = fmax(rmax, fabs(mat_elem(R, i, i)));
+    }
+    for (int64_t i = 0; i < n; i++)
+    {
+        if (fabs(mat_elem(R, i, i)) <= n * DBL_EPSILON * rmax)
+            return false;
+    }
+
+    for (int64_t i = n - 1; i >= 0; i--)
+    {
+        for (int64_t j = 0; j < x->cols; j++)
+        {
+            double val = mat_elem(Qtb, i, j);
+            for (int64_t p = i + 1; p < n; p++)
+            {
+                val -= mat_elem(R, i, p) * pmat_elem(x, p, j);
+            }
+            pmat_elem(x, i, j) = val / mat_elem(R, i, i);
+        }
+    }
+    return true;
+}
+
+// mat_lstsq_tsqr: 縦長の A について ||A x - b|| を最小にする x を求める (TSQR)
+// Aを行方向にnblocks個に分けてそれぞれ並列にQR分解し，並べたRをもう一度QR分解する
+bool mat_lstsq_tsqr(matrix *x, matrix A, matrix b, int nblocks)
+{
+    const int64_t m = A.rows;
+    const int64_t n = A.cols;
+    if (m < n || b.rows != m || x->rows != n || x->cols != b.cols)
+        return false;
+    // 各ブロックは少なくともn行必要
+    if (nblocks > m / n)
+        nblocks = (int)(m / n);
+    if (nblocks < 1)
+        nblocks = 1;
+
+    matrix S, c;
+    if (!mat_alloc(&S, nblocks * n, n))
+        return false;
+    if (!mat_alloc(&c, nblocks * n, b.cols))
+    {
+        mat_free(&S);
+        return false;
+    }
+
+    bool ok = true;
+#pragma omp parallel for schedule(static) reduction(&& : ok)
+    for (int blk = 0; blk < nblocks; blk++)
+    {
+        const int64_t r0 = m * blk / nblocks;
+        const int64_t r1 = m * (blk + 1) / nblocks;
+        matrix Ai, bi;
+        if (!mat_alloc(&Ai, r1 - r0, n))
+        {
+            ok = false;
+            continue;
+        }
+        if (!mat_alloc(&bi, r1 - r0, b.cols))
+        {
+            mat_free(&Ai);
+            ok = false;
+            continue;
+        }
+        memcpy(Ai.elems, &mat_elem(A, r0, 0), (r1 - r0) * n * sizeof(double));
+        memcpy(bi.elems, &mat_elem(b, r0, 0), (r1 - r0) * b.cols * sizeof(double));
+        ok = qr_apply(&Ai, &bi) && ok;
+
+        // R (上三角) と (Q^T b) の上n行を並べる
+        for (int64_t i = 0; i < n; i++)
+        {
+            for (int64_t j = 0; j < n; j++)
+            {
+                mat_elem(S, blk * n + i, j) = j >= i ? mat_elem(Ai, i, j) : 0.0;
+            }
+        }
+        memcpy(&mat_elem(c, blk * n, 0), bi.elems, n * b.cols * sizeof(double));
+        mat_free(&Ai);
+        mat_free(&bi);
+    }
+
+    ok = ok && qr_apply(&S, &c) && qr_back_solve(x, S, c);
+    mat_free(&S);
+    mat_free(&c);
+    return ok;
+}
+
+// mat_lstsq: ||A x - b|| を最小にする x を求める (Aは行数 >= 列数)
+// 正規方程式を作らずQR分解で解くので，条件数が2乗にならない．
+// 十分に縦長で複数スレッドが使えるときはTSQRで解く
+bool mat_lstsq(matrix *x, matrix A, matrix b)
+{
+    const int64_t m = A.rows;
+    const int64_t n = A.cols;
+    if (m < n || b.rows != m || x->rows != n || x->cols != b.cols)
+        return false;
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    if (threads > 1 && m >= 4 * threads * n)
+        return mat_lstsq_tsqr(x, A, b, threads);
+
+    matrix R, Qtb;
+    if (!mat_alloc(&R, m, n))
+        return false;
+    if (!mat_alloc(&Qtb, m, b.cols))
+    {
+        mat_free(&R);
+        return false;
+    }
+    memcpy(R.elems, A.elems, m * n * sizeof(double));
+    memcpy(Qtb.elems, b.elems, m * b.cols * sizeof(double));
+
+    const bool ok = qr_apply(&R, &Qtb) && qr_back_solve(x, R, Qtb);
+    mat_free(&R);
+    mat_free(&Qtb);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// 行列の連鎖積
+// ----------------------------------------------------------------------------
+
+/*
+ * 連鎖積 A0 A1 ... A(count-1) の計算順序
+ * count: 行列の数
+ * split: split[i * count + j] = k なら Ai...Aj を (Ai...Ak)(Ak+1...Aj) の順に計算する
+ * flops: 計算に必要な浮動小数点演算の回数 (乗算と加算を別々に数える)
+ * buffers: 途中結果を置くために使い回す一時領域の数
+ */
+typedef struct
+{
+    int count;
+    int *split;
+    double flops;
+    int buffers;
+} mat_chain_plan;
+
+// chain_need: Ai...Aj を計算するのに同時に必要な一時領域の数
+// 必要な一時領域が多い側を先に計算すると少なく済む (Sethi-Ullman)．
+// to_buffer が false なら結果は一時領域でなく呼び出し側の行列に書く
+static int chain_need(const mat_chain_plan *plan, int i, int j, bool to_buffer)
+{
+    if (i == j)
+        return 0;
+    const int k = plan->split[i * plan->count + j];
+    const int nl = chain_need(plan, i, k, true);
+    const int nr = chain_need(plan, k + 1, j, true);
+    const int hl = i < k ? 1 : 0;
+    const int hr = k + 1 < j ? 1 : 0;
+    const int self = hl + hr + (to_buffer ? 1 : 0);
+    const int left_first = nl > hl + nr ? nl : hl + nr;
+    const int right_first = nr > hr + nl ? nr : hr + nl;
+    const int best = left_first < right_first ? left_first : right_first;
+    return best > self ? best : self;
+}
+
+// mat_chain_plan_make: 行列の形から連鎖積の演算回数が最小になる計算順序を動的計画法で求める
+bool mat_chain_plan_make(mat_chain_plan *plan, const matrix *mats, int count)
+{
+    if (count <= 0)
+        return false;
+    for (int i = 0; i + 1 < count; i++)
+    {
+        if (mats[i].cols != mats[i + 1].rows)
+            return false;
+    }
+
+    double *cost = (double *)calloc((size_t)count * count, sizeof(double));
+    plan->split = (int *)calloc((size_t)count * count, sizeof(int));
+    if (cost == NULL || plan->split == NULL)
+    {
+        free(cost);
+        free(plan->split);
+        plan->split = NULL;
+        return false;
+    }
+    plan->count = count;
+
+    // cost[i * count + j]: Ai...Aj の最小演算回数
+    for (int len = 2; len <= count; len++)
+    {
+        for (int i = 0; i + len - 1 < count; i++)
+        {
+            const int j = i + len - 1;
+            cost[i * count + j] = INFINITY;
+            for (int k = i; k < j; k++)
+            {
+                const double c = cost[i * count + k] + cost[(k + 1) * count + j] +
+                                 2.0 * mats[i].rows * mats[k].cols * mats[j].cols;
+                if (c < cost[i * count + j])
+                {
+                    cost[i * count + j] = c;
+                    plan->split[i * count + j] = k;
+                }
+            }
+        }
+    }
+    plan->flops = cost[count - 1];
+    plan->buffers = chain_need(plan, 0, count - 1, false);
+    free(cost);
+    return true;
+}
+
+// mat_chain_plan_free: 計算順序を解放する
+void mat_chain_plan_free(mat_chain_plan *plan)
+{
+    free(plan->split);
+    plan->split = NULL;
+    plan->count = 0;
+}
+
+// chain_print: Ai...Aj の計算順序を括弧付きで表示する
+static void chain_print(const mat_chain_plan *plan, int i, int j)
+{
+    if (i == j)
+    {
+        printf("A%d", i);
+        return;
+    }
+    const int k = plan->split[i * plan->count + j];
+    printf("(");
+    chain_print(plan, i, k);
+    printf(" ");
+    chain_print(plan, k + 1, j);
+    printf(")");
+}
+
+// mat_chain_plan_print: 計算順序と演算回数を表示する
+void mat_chain_plan_print(const mat_chain_plan *plan)
+{
+    if (plan->split == NULL || plan->count <= 0)
+    {
+        fprintf(stderr, "Plan is empty!\n");
+        return;
+    }
+    chain_print(plan, 0, plan->count - 1);
+    printf("\nflops: %.0f, buffers: %d\n", plan->flops, plan->buffers);
+}
+
+/*
+ * 連鎖積の途中結果を置く一時領域
+ * elems: 一時領域 (どれも最大の途中結果が入る大きさ)
+ * used: 使用中かどうか
+ * count: 確保した一時領域の数
+ * capacity: 一時領域1つあたりの要素数
+ */
+typedef struct
+{
+    double **elems;
+    bool *used;
+    int count;
+    int64_t capacity;
+} chain_pool;
+
+// chain_eval: Ai...Aj を計算し，*outに結果を与える
+// destがNULLなら空いている一時領域に結果を書き，その番号を*slotに返す (一時領域でなければ-1)
+static bool chain_eval(const mat_chain_plan *plan, const matrix *mats, int i, int j,
+                       chain_pool *pool, matrix *dest, matrix *out, int *slot)
+{
+    *slot = -1;
+    if (i == j)
+    {
+        *out = mats[i];
+        return true;
+    }
+
+    // 一時領域を多く必要とする側から計算する
+    const int k = plan->split[i * plan->count + j];
+    const int nl = chain_need(plan, i, k, true);
+    const int nr = chain_need(plan, k + 1, j, true);
+    matrix lhs, rhs;
+    int ls, rs;
+    bool ok;
+    if (nl >= nr)
+        ok = chain_eval(plan, mats, i, k, pool, NULL, &lhs, &ls) && chain_eval(plan, mats, k + 1, j, pool, NULL, &rhs, &rs);
+    else
+        ok = chain_eval(plan, mats, k + 1, j, pool, NULL, &rhs, &rs) && chain_eval(plan, mats, i, k, pool, NULL, &lhs, &ls);
+    if (!ok)
+        return false;
+
+    if (dest != NULL)
+    {
+        *out = *dest;
+    }
+    else
+    {
+        int s = 0;
+        while (s < pool->count && pool->used[s])
+            s++;
+        if (s == pool->count)
+        {
+            pool->elems[s] = (double *)malloc(pool->capacity * sizeof(double));
+            if (pool->elems[s] == NULL)
+                return false;
+            pool->count++;
+        }
+        pool->used[s] = true;
+        *slot = s;
+        out->rows = lhs.rows;
+        out->cols = rhs.cols;
+        out->elems = pool->elems[s];
+    }
+
+    ok = mat_mul(out, lhs, rhs);
+    if (ls >= 0)
+        pool->used[ls] = false;
+    if (rs >= 0)
+        pool->used[rs] = false;
+    return ok;
+}
+
+// chain_capacity: Ai...Aj の計算に現れる途中結果 (Ai...Aj自身を含む) のうち最大の要素数
+static int64_t chain_capacity(const mat_chain_plan *plan, const matrix *mats, int i, int j)
+{
+    if (i == j)
+        return 0;
+    const int k = plan->split[i * plan->count + j];
+    const int64_t l = chain_capacity(plan, mats, i, k);
+    const int64_t r = chain_capacity(plan, mats, k + 1, j);
+    const int64_t self = mats[i].rows * mats[j].cols;
+    return l > r ? (l > self ? l : self) : (r > self ? r : self);
+}
+
+// mat_mul_chain: 連鎖積 mats[0] mats[1] ... mats[count-1] を*resに代入する
+// 演算回数が最小になる順序で計算し，途中結果の一時領域は使い回す．
+// planがNULLでなければ，使った計算順序を*planに与える (使い終わったらmat_chain_plan_freeで解放)
+bool mat_mul_chain(matrix *res, const matrix *mats, int count, mat_chain_plan *plan)
+{
+    mat_chain_plan local;
+    mat_chain_plan *p = plan != NULL ? plan : &local;
+    if (!mat_chain_plan_make(p, mats, count))
+        return false;
+    if (res->rows != mats[0].rows || res->cols != mats[count - 1].cols)
+    {
+        if (plan == NULL)
+            mat_chain_plan_free(&local);
+        return false;
+    }
+
+    bool ok;
+    if (count == 1)
+    {
+        // *res が mats[0] 自身 (または一部が重なる) こともあるので memmove で写す
+        memmove(res->elems, mats[0].elems, res->rows * res->cols * sizeof(double));
+        ok = true;
+    }
+    else
+    {
+        chain_pool pool;
+        pool.elems = (double **)calloc(count, sizeof(double *));
+        pool.used = (bool *)calloc(count, sizeof(bool));
+        pool.count = 0;
+        // 最後の積は*resに直接書くので，一時領域は左右の途中結果が入ればよい
+        const int k = p->split[count - 1];
+        const int64_t cl = chain_capacity(p, mats, 0, k);
+        const int64_t cr = chain_capacity(p, mats, k + 1, count - 1);
+        pool.capacity = cl > cr ? cl : cr;
+
+        matrix out;
+        int slot;
+        ok = pool.elems != NULL && pool.used != NULL &&
+             chain_eval(p, mats, 0, count - 1, &pool, res, &out, &slot);
+
+        for (int s = 0; s < pool.count; s++)
+        {
+            free(pool.elems[s]);
+        }
+        free(pool.elems);
+        free(pool.used);
+    }
+
+    if (plan == NULL)
+        mat_chain_plan_free(&local);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// 低ランク更新
+// ----------------------------------------------------------------------------
+
+/*
+ * A が A + U V^T (U, V は n x k) と少しずつ変わるとき，逆行列・LU分解・コレスキー分解を
+ * 最初から計算し直さずに O(n^2 k) で更新する．どの関数も A 自身も同じように更新するので，
+ * 呼び出し側は A とその分解を組にして持っておく．
+ *
+ * 更新を重ねると丸め誤差が溜まるので，更新のたびに探査ベクトル z について
+ * A z を解き直して z に戻るかを O(n^2) で確かめ，ずれが大きければ A から分解し直す．
+ */
+
+// 探査ベクトルで測った相対誤差がこれを超えたら分解し直す
+static double mat_drift_tol = 1.0e-8;
+
+// 探査ベクトルを作る乱数の種
+#define MAT_PROBE_SEED 0x9e3779b97f4a7c15ULL
+
+// mat_set_drift_tol: 分解し直すかを決める相対誤差の閾値を設定する
+void mat_set_drift_tol(double tol)
+{
+    mat_drift_tol = tol;
+}
+
+// mat_lu: Aをピボット選択付きでLU分解し，LとU (Lの対角の1は省く) を*LUにまとめて入れる
+// piv[i] は i 行目と交換した行 (LAPACKのipivと同じ)．特異ならfalse
+bool mat_lu(matrix *LU, int64_t *piv, matrix A)
+{
+    if (A.rows != A.cols || !mat_same_size(*LU, A))
+        return false;
+    if (LU->elems != A.elems)
+        memcpy(LU->elems, A.elems, A.rows * A.cols * sizeof(double));
+    return lu_tasks(LU, piv);
+}
+
+// mat_lu_solve: mat_lu の結果を使って A x = b を解く (xとbは同じ行列でもよい)
+bool mat_lu_solve(matrix *x, matrix LU, const int64_t *piv, matrix b)
+{
+    if (LU.rows != LU.cols || b.rows != LU.rows || !mat_same_size(*x, b))
+        return false;
+    if (x->elems != b.elems)
+        memcpy(x->elems, b.elems, b.rows * b.cols * sizeof(double));
+    lu_solve_tasks(LU, piv, x);
+    return true;
+}
+
+// mat_chol: 対称正定値行列Aをコレスキー分解し，A = L L^T となる下三角行列を*Lに代入する
+// (*LとAは同じ行列でもよい)．正定値でなければfalse
+bool mat_chol(matrix *L, matrix A)
+{
+    const int64_t n = A.rows;
+    if (A.cols != n || !mat_same_size(*L, A))
+        return false;
+    if (L->elems != A.elems)
+        memcpy(L->elems, A.elems, n * n * sizeof(double));
+
+    // 計算量 (n^3/3) が小さければ，スレッドを起こさずに同じタイル分割で1スレッドで計算する
+    const double task_min = mat_params()->task_min;
+    if (!chol_tasks(L, (double)n * n * n / 3.0 >= task_min * task_min * task_min))
+        return false;
+    for (int64_t i = 0; i < n; i++)
+    {
+        memset(&pmat_elem(L, i, i + 1), 0, (n - i - 1) * sizeof(double));
+    }
+    return true;
+}
+
+// lowrank_add: A (n x n) に alpha * P (n x k) * Q (k x n) を加え，結果の要素の絶対値の最大値を返す
+static double lowrank_add(matrix *A, matrix P, matrix Q, double alpha)
+{
+    const int64_t n = A->rows;
+    double amax = 0.0;
+#pragma omp parallel for schedule(static) reduction(max : amax)
+    for (int64_t i = 0; i < n; i++)
+    {
+        gemm_block(&pmat_elem(A, i, 0), &mat_elem(P, i, 0), Q.elems, 1, n, P.cols, P.cols, n, n, alpha);
+        for (int64_t j = 0; j < n; j++)
+        {
+            amax = fmax(amax, fabs(pmat_elem(A, i, j)));
+        }
+    }
+    return amax;
+}
+
+// lowrank_valid: Aが n x n，U, V が n x k の行列か
+static bool lowrank_valid(matrix A, matrix U, matrix V)
+{
+    return A.rows == A.cols && U.rows == A.rows && mat_same_size(U, V);
+}
+
+// lowrank_rows: n x k の行列Uの転置 (各列が連続した k x n の行列) を*tに確保して代入する
+static bool lowrank_rows(matrix *t, matrix U)
+{
+    if (!mat_alloc(t, U.cols, U.rows))
+        return false;
+    mat_trans(t, U);
+    return true;
+}
+
+// drift_probe: 探査ベクトル z と r = A z (どちらも n x 1) を確保して代入する
+static bool drift_probe(matrix A, matrix *z, matrix *r)
+{
+    const int64_t n = A.rows;
+    if (!mat_alloc(z, n, 1))
+        return false;
+    if (!mat_alloc(r, n, 1))
+    {
+        mat_free(z);
+        return false;
+    }
+    for (int64_t i = 0; i < n; i++)
+    {
+        z->elems[i] = 1.0 + philox_uniform_at(MAT_PROBE_SEED, (uint64_t)i);
+    }
+    mat_mul(r, A, *z);
+    return true;
+}
+
+// drift_error: 解き直した w と探査ベクトル z の相対誤差 (最大値ノルム)
+static double drift_error(matrix z, matrix w)
+{
+    double err = 0.0, norm = 0.0;
+    for (int64_t i = 0; i < z.rows; i++)
+    {
+        err = fmax(err, fabs(w.elems[i] - z.elems[i]));
+        norm = fmax(norm, fabs(z.elems[i]));
+    }
+    // NaN が混じったときも分解し直させる
+    return err == err ? err / norm : INFINITY;
+}
+
+// mat_inverse_update: *invA = A^-1 から (A + U V^T)^-1 を Sherman-Morrison-Woodbury の公式
+//   (A + U V^T)^-1 = A^-1 - A^-1 U (I + V^T A^-1 U)^-1 V^T A^-1
+// で求め，*A も A + U V^T に更新する．
+// 精度が落ちていれば (または I + V^T A^-1 U が特異なら) 更新後の *A から逆行列を計算し直し，
+// そのとき *refactored を true にする (NULL なら無視)．更新後の *A が特異ならfalse
+bool mat_inverse_update(matrix *invA, matrix *A, matrix U, matrix V, bool *refactored)
+{
+    const int64_t n = A->rows, k = U.cols;
+    if (!lowrank_valid(*A, U, V) || !mat_same_size(*invA, *A))
+        return false;
+
+    // W = A^-1 U (n x k)，Y = V^T A^-1 (k x n)，S = I + V^T W (k x k)
+    matrix Vt, W, Y, S, Z;
+    Vt.elems = W.elems = Y.elems = S.elems = Z.elems = NULL;
+    bool ok = lowrank_rows(&Vt, V) && mat_alloc(&W, n, k) && mat_alloc(&Y, k, n) &&
+              mat_alloc(&S, k, k) && mat_alloc(&Z, k, n);
+    if (!ok)
+    {
+        mat_free(&Vt);
+        mat_free(&W);
+        mat_free(&Y);
+        mat_free(&S);
+        return false;
+    }
+    mat_mul(&W, *invA, U);
+    mat_mul(&Y, Vt, *invA);
+    mat_mul(&S, Vt, W);
+    for (int64_t i = 0; i < k; i++)
+    {
+        mat_elem(S, i, i) += 1.0;
+    }
+
+    // A^-1 から W (S^-1 Y) を引く
+    bool fresh = !mat_solve(&Z, S, Y);
+    if (!fresh)
+        lowrank_add(invA, W, Z, -1.0);
+    lowrank_add(A, U, Vt, 1.0);
+
+    matrix z, r;
+    if (!fresh && drift_probe(*A, &z, &r))
+    {
+        // Y はもう使わないので，解き直した結果の置き場にする
+        matrix w = {n, 1, Y.elems};
+        mat_mul(&w, *invA, r);
+        fresh = drift_error(z, w) > mat_drift_tol;
+        mat_free(&z);
+        mat_free(&r);
+    }
+    ok = !fresh || mat_inverse(invA, *A);
+    if (refactored != NULL)
+        *refactored = fresh;
+
+    mat_free(&Vt);
+    mat_free(&W);
+    mat_free(&Y);
+    mat_free(&S);
+    mat_free(&Z);
+    return ok;
+}
+
+// lu_rank1: L U に x y^T を加えたものを L' U' に書き換える (Bennettの方法，x, y は壊される)
+// 1段目を消去すると，残りの部分には (x2 - x1 l)(d y2 - y1 u)^T / d' の形の階数1の項が残るので，
+// それを次の段に渡していく．ピボットの絶対値がtol以下になるか，
+// ピボットの計算で桁落ちして有効桁が半分以下になったらfalse
+static bool lu_rank1(matrix *LU, double *x, double *y, double tol)
+{
+    const int64_t n = LU->rows;
+    const double cancel = sqrt(DBL_EPSILON);
+    for (int64_t k = 0; k < n; k++)
+    {
+        const double d = pmat_elem(LU, k, k);
+        const double dn = d + x[k] * y[k];
+        if (!(fabs(dn) > tol && fabs(dn) > cancel * (fabs(d) + fabs(x[k] * y[k]))))
+            return false;
+        pmat_elem(LU, k, k) = dn;
+
+        double *uk = &pmat_elem(LU, k, 0);
+        for (int64_t j = k + 1; j < n; j++)
+        {
+            const double u = uk[j];
+            uk[j] = u + x[k] * y[j];
+            y[j] = (d * y[j] - y[k] * u) / dn;
+        }
+        for (int64_t i = k + 1; i < n; i++)
+        {
+            const double l = pmat_elem(LU, i, k);
+            pmat_elem(LU, i, k) = (l * d + x[i] * y[k]) / dn;
+            x[i] -= x[k] * l;
+        }
+    }
+    return true;
+}
+
+// mat_lu_update: mat_lu の結果 (*LU, piv) を A + U V^T のLU分解に更新し，*A も A + U V^T にする．
+// ピボットの位置は変えずに列ごとに階数1の更新を k 回行う．
+// ピボットが小さくなりすぎたり精度が落ちていれば更新後の *A から分解し直し，
+// そのとき *refactored を true にする (NULL なら無視)．更新後の *A が特異ならfalse
+bool mat_lu_update(matrix *LU, int64_t *piv, matrix *A, matrix U, matrix V, bool *refactored)
+{
+    const int64_t n = A->rows;
+    if (!lowrank_valid(*A, U, V) || !mat_same_size(*LU, *A))
+        return false;
+
+    // 各列を連続した行として取り出す
+    matrix Ut, Vt;
+    if (!lowrank_rows(&Ut, U))
+        return false;
+    if (!lowrank_rows(&Vt, V))
+    {
+        mat_free(&Ut);
+        return false;
+    }
+    const double amax = lowrank_add(A, U, Vt, 1.0);
+    const double tol = n * DBL_EPSILON * amax;
+
+    // P A = L U なので，P (A + u v^T) = L U + (P u) v^T
+    bool fresh = false;
+    for (int64_t c = 0; c < U.cols && !fresh; c++)
+    {
+        double *x = &mat_elem(Ut, c, 0);
+        for (int64_t i = 0; i < n; i++)
+        {
+            swap(x[i], x[piv[i]]);
+        }
+        fresh = !lu_rank1(LU, x, &mat_elem(Vt, c, 0), tol);
+    }
+
+    matrix z, r;
+    if (!fresh && drift_probe(*A, &z, &r))
+    {
+        lu_solve_tasks(*LU, piv, &r);
+        fresh = drift_error(z, r) > mat_drift_tol;
+        mat_free(&z);
+        mat_free(&r);
+    }
+    const bool ok = !fresh || mat_lu(LU, piv, *A);
+    if (refactored != NULL)
+        *refactored = fresh;
+
+    mat_free(&Ut);
+    mat_free(&Vt);
+    return ok;
+}
+
+// chol_rank1: L L^T に sign * x x^T を加えたものを L' L'^T に書き換える (x は壊される)
+// 各列を回転 (sign < 0 なら双曲回転) で更新する．正定値でなくなったらfalse
+static bool chol_rank1(matrix *L, double *x, double sign)
+{
+    const int64_t n = L->rows;
+    for (int64_t k = 0; k < n; k++)
+    {
+        const double lkk = pmat_elem(L, k, k);
+        const double r2 = lkk * lkk + sign * x[k] * x[k];
+        if (!(r2 > 0.0))
+            return false;
+        const double r = sqrt(r2);
+        const double c = r / lkk, s = x[k] / lkk;
+        pmat_elem(L, k, k) = r;
+        for (int64_t i = k + 1; i < n; i++)
+        {
+            const double l = (pmat_elem(L, i, k) + sign * s * x[i]) / c;
+            pmat_elem(L, i, k) = l;
+            x[i] = c * x[i] - s * l;
+        }
+    }
+    return true;
+}
+
+// chol_solve: L L^T w = b を解き，b (n x 1) を w で上書きする
+static void chol_solve(matrix L, matrix *b)
+{
+    const int64_t n = L.rows;
+    double *w = b->elems;
+    for (int64_t i = 0; i < n; i++)
+    {
+        const double *li = &mat_elem(L, i, 0);
+        double s = w[i];
+        for (int64_t p = 0; p < i; p++)
+        {
+            s -= li[p] * w[p];
+        }
+        w[i] = s / li[i];
+    }
+    // L^T の後退代入は L の行を使って右辺から引いていく
+    for (int64_t i = n - 1; i >= 0; i--)
+    {
+        const double *li = &mat_elem(L, i, 0);
+        w[i] /= li[i];
+        for (int64_t p = 0; p < i; p++)
+        {
+            w[p] -= li[p] * w[i];
+        }
+    }
+}
+
+// mat_chol_update: mat_chol の結果 *L を A + X X^T (downdate なら A - X X^T) のコレスキー分解に
+// 更新し，*A も同じように更新する (X は n x k)．
+// 途中で正定値でなくなったり精度が落ちていれば更新後の *A から分解し直し，
+// そのとき *refactored を true にする (NULL なら無視)．更新後の *A が正定値でなければfalse
+bool mat_chol_update(matrix *L, matrix *A, matrix X, bool downdate, bool *refactored)
+{
+    if (!lowrank_valid(*A, X, X) || !mat_same_size(*L, *A))
+        return false;
+
+    matrix Xt;
+    if (!lowrank_rows(&Xt, X))
+        return false;
+    const double sign = downdate ? -1.0 : 1.0;
+    lowrank_add(A, X, Xt, sign);
+
+    bool fresh = false;
+    for (int64_t c = 0; c < X.cols && !fresh; c++)
+    {
+        fresh = !chol_rank1(L, &mat_elem(Xt, c, 0), sign);
+    }
+
+    matrix z, r;
+    if (!fresh && drift_probe(*A, &z, &r))
+    {
+        chol_solve(*L, &r);
+        fresh = drift_error(z, r) > mat_drift_tol;
+        mat_free(&z);
+        mat_free(&r);
+    }
+    const bool ok = !fresh || mat_chol(L, *A);
+    if (refactored != NULL)
+        *refactored = fresh;
+
+    mat_free(&Xt);
+    return ok;
 }
@@ -0,0 +1,314 @@
+#ifndef MATRIX_HPP
+#define MATRIX_HPP
+
+// matrix.c の swap マクロが標準ライブラリ内の std::swap と衝突しないよう，
+// 標準ヘッダは matrix.c より先に読み込んでおく
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _NOT_USE_HEADER
+#include "matrix.c"
+#else
+#include "matrix.h"
+#endif
+
+/*
+ * 行列の一部分への参照 (メモリは所有しない)
+ * elems: 左上の要素へのポインタ
+ * rows: 行数
+ * cols: 列数
+ * stride: 次の行までの要素数 (元の行列の列数)
+ */
+class MatrixView
+{
+public:
+    MatrixView(double *elems, int64_t rows, int64_t cols, int64_t stride)
+        : elems_(elems), rows_(rows), cols_(cols), stride_(stride) {}
+
+    int64_t rows() const { return rows_; }
+    int64_t cols() const { return cols_; }
+    int64_t stride() const { return stride_; }
+    double &operator()(int64_t i, int64_t j) const { return elems_[i * stride_ + j]; }
+
+    // 行が隙間なく並んでいれば (列の範囲が元の行列全体なら) C の関数にそのまま渡せる
+    // 並んでいなければ std::invalid_argument を投げる
+    bool contiguous() const { return stride_ == cols_; }
+    matrix c() const
+    {
+        if (!contiguous())
+            throw std::invalid_argument("MatrixView::c: view is not contiguous");
+        matrix m;
+        m.rows = rows_;
+        m.cols = cols_;
+        m.elems = elems_;
+        return m;
+    }
+
+private:
+    double *elems_;
+    int64_t rows_;
+    int64_t cols_;
+    int64_t stride_;
+};
+
+/*
+ * 行列要素のメモリを所有する行列
+ *
+ * コピーは要素を共有して参照数を増やすだけで，書き込むときに初めて複製する (copy-on-write)．
+ * ムーブは要素の所有権を移すだけ．どちらも n x n の複製は起きない．
+ * 要素を読むときは at() を使う．C の関数には，読むだけなら c() を，書き込むなら mut() を渡す．
+ *
+ * mut() が返す Mut は，生きている間 (ふつうは C の関数を呼ぶ式の終わりまで) だけ要素を共有しない．
+ * 残り続ける書き込み用の参照 (非constの operator()，view()) を渡した後は，
+ * その参照から後で書き込まれるかもしれないので要素を共有しない (以後のコピーは複製になる)．
+ */
+class Matrix
+{
+    /*
+     * 共有される要素
+     * refs: 参照している Matrix の数
+     * sharable: 残り続ける書き込み用の参照を渡していないか (false ならコピーは複製にする)
+     * borrows: 生きている Mut の数 (0 でなければコピーは複製にする)
+     * m: 要素を持つ行列
+     */
+    struct Storage
+    {
+        std::atomic<long> refs;
+        bool sharable;
+        int borrows;
+        matrix m;
+    };
+
+public:
+    Matrix() : s_(NULL) {}
+
+    // rows x cols の行列を確保する．
+    // 行数・列数が正でなければ std::invalid_argument を，確保できなければ std::bad_alloc を投げる
+    Matrix(int64_t rows, int64_t cols) : s_(NULL)
+    {
+        if (rows <= 0 || cols <= 0)
+            throw std::invalid_argument("Matrix: rows and cols must be positive");
+        s_ = new Storage;
+        s_->refs.store(1);
+        s_->sharable = true;
+        s_->borrows = 0;
+        if (!mat_alloc(&s_->m, rows, cols))
+        {
+            delete s_;
+            throw std::bad_alloc();
+        }
+    }
+
+    Matrix(const Matrix &other) : s_(NULL) { share(other); }
+    Matrix(Matrix &&other) noexcept : s_(other.s_) { other.s_ = NULL; }
+
+    Matrix &operator=(const Matrix &other)
+    {
+        if (s_ != other.s_)
+        {
+            release();
+            share(other);
+        }
+        return *this;
+    }
+
+    Matrix &operator=(Matrix &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            s_ = other.s_;
+            other.s_ = NULL;
+        }
+        return *this;
+    }
+
+    ~Matrix() { release(); }
+
+    int64_t rows() const { return s_ != NULL ? s_->m.rows : 0; }
+    int64_t cols() const { return s_ != NULL ? s_->m.cols : 0; }
+    bool empty() const { return s_ == NULL; }
+
+    // 要素を共有している Matrix の数
+    long use_count() const { return s_ != NULL ? s_->refs.load() : 0; }
+
+    // 要素を読む (共有をやめない)
+    double at(int64_t i, int64_t j) const { return mat_elem(s_->m, i, j); }
+
+    // 読むための要素参照
+    const double &operator()(int64_t i, int64_t j) const { return mat_elem(s_->m, i, j); }
+
+    // 書くための要素参照 (共有していれば先に複製する)
+    double &operator()(int64_t i, int64_t j)
+    {
+        return mat_elem(*escape(), i, j);
+    }
+
+    // C の関数に読み込み用として渡す行列
+    matrix c() const
+    {
+        if (s_ != NULL)
+            return s_->m;
+        matrix m;
+        m.rows = 0;
+        m.cols = 0;
+        m.elems = NULL;
+        return m;
+    }
+
+    /*
+     * mut() が返す書き込み用の参照．matrix * に変換して C の関数に渡す．
+     * 生きている間のコピーは複製になり，破棄されると再び要素を共有できるようになる．
+     * 元の Matrix より長く (また元の Matrix に代入した後まで) 残してはいけない
+     */
+    class Mut
+    {
+    public:
+        Mut(Mut &&other) noexcept : s_(other.s_), m_(other.m_) { other.s_ = NULL; }
+        Mut(const Mut &) = delete;
+        Mut &operator=(const Mut &) = delete;
+        ~Mut()
+        {
+            if (s_ != NULL)
+                s_->borrows--;
+        }
+
+        operator matrix *() const { return m_; }
+        matrix *operator->() const { return m_; }
+
+    private:
+        friend class Matrix;
+        Mut(Storage *s, matrix *m) : s_(s), m_(m)
+        {
+            if (s_ != NULL)
+                s_->borrows++;
+        }
+
+        Storage *s_;
+        matrix *m_;
+    };
+
+    // C の関数に書き込み先として渡す行列 (共有していれば先に複製する)
+    Mut mut()
+    {
+        detach();
+        return Mut(s_, s_ != NULL ? &s_->m : NULL);
+    }
+
+    // 要素を複製した行列を返す
+    Matrix clone() const
+    {
+        if (s_ == NULL)
+            return Matrix();
+        Matrix m(rows(), cols());
+        memcpy(m.s_->m.elems, s_->m.elems, rows() * cols() * sizeof(double));
+        return m;
+    }
+
+    // (r0, c0) から rows x cols の部分への書き込み用の参照
+    MatrixView view(int64_t r0, int64_t c0, int64_t rows, int64_t cols)
+    {
+        if (r0 < 0 || c0 < 0 || rows < 0 || cols < 0 || r0 + rows > this->rows() || c0 + cols > this->cols())
+            throw std::out_of_range("Matrix::view");
+        return MatrixView(&mat_elem(*escape(), r0, c0), rows, cols, this->cols());
+    }
+
+private:
+    Storage *s_;
+
+    void retain()
+    {
+        if (s_ != NULL)
+            s_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release()
+    {
+        if (s_ != NULL && s_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            mat_free(&s_->m);
+            delete s_;
+        }
+        s_ = NULL;
+    }
+
+    // other の要素を共有する (書き込み用の参照を渡している要素なら複製する)
+    void share(const Matrix &other)
+    {
+        if (other.s_ != NULL && (!other.s_->sharable || other.s_->borrows > 0))
+        {
+            *this = other.clone();
+            return;
+        }
+        s_ = other.s_;
+        retain();
+    }
+
+    // 他の Matrix と要素を共有していれば，自分用に複製する
+    void detach()
+    {
+        if (s_ != NULL && s_->refs.load(std::memory_order_acquire) > 1)
+            *this = clone();
+    }
+
+    // 書き込み用の参照を渡す前に呼ぶ: 自分用に複製し，以後は共有しない
+    matrix *escape()
+    {
+        detach();
+        if (s_ == NULL)
+            return NULL;
+        s_->sharable = false;
+        return &s_->m;
+    }
+
+    // 書き込み先として C の関数に渡すが，参照は外に残らないとき (演算子の結果) に使う
+    matrix *raw() { return s_ != NULL ? &s_->m : NULL; }
+
+    friend Matrix operator+(const Matrix &a, const Matrix &b);
+    friend Matrix operator-(const Matrix &a, const Matrix &b);
+    friend Matrix operator*(const Matrix &a, const Matrix &b);
+    friend Matrix transpose(const Matrix &a);
+};
+
+// C の関数の結果を値で返す演算．大きさが合わない (空の行列を含む) ときは std::invalid_argument を投げる
+inline Matrix operator+(const Matrix &a, const Matrix &b)
+{
+    if (a.empty() || a.rows() != b.rows() || a.cols() != b.cols())
+        throw std::invalid_argument("matrix size mismatch");
+    Matrix res(a.rows(), a.cols());
+    mat_add(res.raw(), a.c(), b.c());
+    return res;
+}
+
+inline Matrix operator-(const Matrix &a, const Matrix &b)
+{
+    if (a.empty() || a.rows() != b.rows() || a.cols() != b.cols())
+        throw std::invalid_argument("matrix size mismatch");
+    Matrix res(a.rows(), a.cols());
+    mat_sub(res.raw(), a.c(), b.c());
+    return res;
+}
+
+inline Matrix operator*(const Matrix &a, const Matrix &b)
+{
+    if (a.empty() || b.empty() || a.cols() != b.rows())
+        throw std::invalid_argument("matrix size mismatch");
+    Matrix res(a.rows(), b.cols());
+    if (!mat_mul(res.raw(), a.c(), b.c()))
+        throw std::bad_alloc();
+    return res;
+}
+
+inline Matrix transpose(const Matrix &a)
+{
+    if (a.empty())
+        throw std::invalid_argument("matrix size mismatch");
+    Matrix res(a.cols(), a.rows());
+    mat_trans(res.raw(), a.c());
+    return res;
+}
+
+#endif